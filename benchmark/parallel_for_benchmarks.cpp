@@ -0,0 +1,175 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/index_range.hpp"
+#include "crunch/concurrency/parallel_for.hpp"
+#include "crunch/concurrency/task_scheduler.hpp"
+
+#include "crunch/benchmarking/stopwatch.hpp"
+#include "crunch/benchmarking/result_table.hpp"
+
+#include "crunch/test/framework.hpp"
+
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(ParallelForBenchmarks)
+
+BOOST_AUTO_TEST_CASE(LazySplitBenchmark)
+{
+    using namespace Benchmarking;
+
+    std::size_t const size = 1 << 20;
+    int const sampleCount = 10;
+
+    ResultTable<std::tuple<double, double, double, double>> results(
+        "Concurrency.ParallelFor.LazySplit",
+        1,
+        std::make_tuple("eager ns per element", "eager tasks", "lazy ns per element", "lazy tasks"));
+
+    TaskScheduler::Config config;
+    config.workerCount = 3;
+    TaskScheduler scheduler(config);
+
+    std::vector<float> values(size, 1.0f);
+    auto body = [&](IndexRange<std::size_t> const& r) {
+        for (auto i = r.Begin(); i != r.End(); ++i)
+            values[i] = values[i] * 0.5f + 1.0f;
+    };
+
+    for (int sample = 0; sample < sampleCount; ++sample)
+    {
+        IndexRange<std::size_t> const range(0, size);
+
+        std::uint64_t const eagerTasksBefore = scheduler.GetStatistics().tasksExecuted;
+        Stopwatch eagerStopwatch;
+        eagerStopwatch.Start();
+        Future<void> eager = scheduler.Add([&] { return ParallelFor(scheduler, range, body, SimplePartitioner()); });
+        scheduler.WaitFor(eager);
+        eagerStopwatch.Stop();
+        std::uint64_t const eagerTasks = scheduler.GetStatistics().tasksExecuted - eagerTasksBefore;
+
+        std::uint64_t const lazyTasksBefore = scheduler.GetStatistics().tasksExecuted;
+        Stopwatch lazyStopwatch;
+        lazyStopwatch.Start();
+        Future<void> lazy = ParallelFor(scheduler, range, body);
+        scheduler.WaitFor(lazy);
+        lazyStopwatch.Stop();
+        std::uint64_t const lazyTasks = scheduler.GetStatistics().tasksExecuted - lazyTasksBefore;
+
+        results.Add(std::make_tuple(
+            eagerStopwatch.GetElapsedNanoseconds() / size,
+            static_cast<double>(eagerTasks),
+            lazyStopwatch.GetElapsedNanoseconds() / size,
+            static_cast<double>(lazyTasks)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PartitionerBenchmark)
+{
+    using namespace Benchmarking;
+
+    std::size_t const size = 1 << 22;
+    std::size_t const grainSize = 256;
+    int const sampleCount = 10;
+
+    ResultTable<std::tuple<double, double, double>> results(
+        "Concurrency.ParallelFor.Partitioner",
+        1,
+        std::make_tuple("simple ns per element", "auto ns per element", "static ns per element"));
+
+    TaskScheduler::Config config;
+    config.workerCount = 3;
+    TaskScheduler scheduler(config);
+
+    // Uniform cost per iteration
+    std::vector<float> values(size, 1.0f);
+    auto body = [&](IndexRange<std::size_t> const& r) {
+        for (auto i = r.Begin(); i != r.End(); ++i)
+            values[i] = values[i] * 0.5f + 1.0f;
+    };
+
+    IndexRange<std::size_t> const range(0, size, grainSize);
+    for (int sample = 0; sample < sampleCount; ++sample)
+    {
+        Stopwatch simpleStopwatch;
+        simpleStopwatch.Start();
+        Future<void> simple = ParallelFor(scheduler, range, body, SimplePartitioner());
+        scheduler.WaitFor(simple);
+        simpleStopwatch.Stop();
+
+        Stopwatch autoStopwatch;
+        autoStopwatch.Start();
+        Future<void> adaptive = ParallelFor(scheduler, range, body, AutoPartitioner());
+        scheduler.WaitFor(adaptive);
+        autoStopwatch.Stop();
+
+        Stopwatch staticStopwatch;
+        staticStopwatch.Start();
+        Future<void> fixed = ParallelFor(scheduler, range, body, StaticPartitioner());
+        scheduler.WaitFor(fixed);
+        staticStopwatch.Stop();
+
+        results.Add(std::make_tuple(
+            simpleStopwatch.GetElapsedNanoseconds() / size,
+            autoStopwatch.GetElapsedNanoseconds() / size,
+            staticStopwatch.GetElapsedNanoseconds() / size));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(AffinityBenchmark)
+{
+    using namespace Benchmarking;
+
+    // Small enough for the blocks of each context to stay in its caches between sweeps
+    std::size_t const size = 1 << 18;
+    int const sweepCount = 100;
+    int const sampleCount = 10;
+
+    ResultTable<std::tuple<double, double>> results(
+        "Concurrency.ParallelFor.Affinity",
+        1,
+        std::make_tuple("auto ns per element", "affinity ns per element"));
+
+    TaskScheduler::Config config;
+    config.workerCount = 3;
+    TaskScheduler scheduler(config);
+
+    std::vector<float> values(size, 1.0f);
+    auto body = [&](IndexRange<std::size_t> const& r) {
+        for (auto i = r.Begin(); i != r.End(); ++i)
+            values[i] = values[i] * 0.5f + 1.0f;
+    };
+
+    IndexRange<std::size_t> const range(0, size, 1024);
+    AffinityPartitioner partitioner;
+    for (int sample = 0; sample < sampleCount; ++sample)
+    {
+        Stopwatch autoStopwatch;
+        autoStopwatch.Start();
+        for (int sweep = 0; sweep < sweepCount; ++sweep)
+        {
+            Future<void> adaptive = ParallelFor(scheduler, range, body, AutoPartitioner());
+            scheduler.WaitFor(adaptive);
+        }
+        autoStopwatch.Stop();
+
+        Stopwatch affinityStopwatch;
+        affinityStopwatch.Start();
+        for (int sweep = 0; sweep < sweepCount; ++sweep)
+        {
+            Future<void> affine = ParallelFor(scheduler, range, body, partitioner);
+            scheduler.WaitFor(affine);
+        }
+        affinityStopwatch.Stop();
+
+        results.Add(std::make_tuple(
+            autoStopwatch.GetElapsedNanoseconds() / (size * sweepCount),
+            affinityStopwatch.GetElapsedNanoseconds() / (size * sweepCount)));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
@@ -0,0 +1,333 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/coroutine.hpp"
+#include "crunch/concurrency/meta_scheduler.hpp"
+#include "crunch/concurrency/task_scheduler.hpp"
+#include "crunch/concurrency/thread.hpp"
+#include "crunch/concurrency/when_all.hpp"
+
+#include "crunch/benchmarking/stopwatch.hpp"
+#include "crunch/benchmarking/result_table.hpp"
+
+#include "crunch/test/framework.hpp"
+
+#include "../test/waiting_tasks.hpp"
+
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(TaskSchedulerBenchmarks)
+
+BOOST_AUTO_TEST_CASE(ExternalSubmissionBenchmark)
+{
+    using namespace Benchmarking;
+
+    int const workerCount = 2;
+    std::uint32_t const totalTaskCount = 1 << 18;
+
+    ResultTable<std::tuple<int, double, double>> results(
+        "Concurrency.TaskScheduler.ExternalSubmission",
+        1,
+        std::make_tuple("producers", "ns per task", "tasks per second"));
+
+    for (int producerCount = 1; producerCount <= 16; producerCount *= 2)
+    {
+        TaskScheduler::Config schedulerConfig;
+        schedulerConfig.workerCount = workerCount;
+        TaskScheduler scheduler(schedulerConfig);
+        Atomic<std::uint32_t> runCount(0);
+
+        std::uint32_t const tasksPerProducer = totalTaskCount / producerCount;
+
+        Stopwatch stopwatch;
+        stopwatch.Start();
+
+        std::vector<std::shared_ptr<Thread>> producers;
+        for (int p = 0; p < producerCount; ++p)
+        {
+            producers.push_back(std::make_shared<Thread>([&] {
+                for (std::uint32_t i = 0; i < tasksPerProducer; ++i)
+                    scheduler.Add([&] { runCount.Increment(MEMORY_ORDER_RELAXED); });
+            }));
+        }
+
+        for (std::size_t p = 0; p < producers.size(); ++p)
+            producers[p]->Join();
+
+        while (runCount.Load(MEMORY_ORDER_RELAXED) != tasksPerProducer * producerCount);
+
+        stopwatch.Stop();
+
+        double const nsPerTask = stopwatch.GetElapsedNanoseconds() / (tasksPerProducer * producerCount);
+        results.Add(std::make_tuple(producerCount, nsPerTask, 1e9 / nsPerTask));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(IdleWakeBenchmark)
+{
+    using namespace Benchmarking;
+
+    int const workerCount = 4;
+    int const wakeCount = 200;
+    std::chrono::milliseconds const idlePeriod(200);
+
+    ResultTable<std::tuple<std::uint32_t, double, double>> results(
+        "Concurrency.TaskScheduler.IdleWake",
+        1,
+        std::make_tuple("spin count", "wake latency us", "idle cpu percent"));
+
+    for (std::uint32_t spinCount = 0; spinCount <= 4096; spinCount = spinCount == 0 ? 256 : spinCount * 16)
+    {
+        TaskScheduler::Config config;
+        config.workerCount = workerCount;
+        config.idleSpinCount = spinCount;
+        TaskScheduler scheduler(config);
+
+        // CPU time used by the process while all workers are idle
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::clock_t const cpuStart = std::clock();
+        std::this_thread::sleep_for(idlePeriod);
+        double const cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+        double const idleCpuPercent = 100.0 * cpuSeconds / std::chrono::duration<double>(idlePeriod).count();
+
+        // Time from adding a task until it starts running, with workers given time to park in between
+        double totalLatency = 0;
+        for (int i = 0; i < wakeCount; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            Atomic<std::uint32_t> started(0);
+            Stopwatch stopwatch;
+            stopwatch.Start();
+            scheduler.Add([&] { started.Store(1, MEMORY_ORDER_RELEASE); });
+            while (started.Load(MEMORY_ORDER_ACQUIRE) == 0);
+            stopwatch.Stop();
+
+            totalLatency += stopwatch.GetElapsedNanoseconds();
+        }
+
+        results.Add(std::make_tuple(spinCount, totalLatency / wakeCount / 1000, idleCpuPercent));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(DependentChainBenchmark)
+{
+    using namespace Benchmarking;
+
+    int const chainLength = 1 << 16;
+    int const sampleCount = 10;
+
+    ResultTable<std::tuple<double>> results(
+        "Concurrency.TaskScheduler.DependentChain",
+        1,
+        std::make_tuple("ns per task"));
+
+    TaskScheduler scheduler;
+    scheduler.Enter();
+    NullThrottler throttler;
+
+    for (int sample = 0; sample < sampleCount; ++sample)
+    {
+        std::vector<Future<void>> chain;
+        chain.reserve(chainLength);
+        std::uint32_t counter = 0;
+        chain.push_back(scheduler.Add([&] { counter++; }));
+        for (int i = 1; i < chainLength; ++i)
+        {
+            IWaitable* dependency = &chain.back();
+            chain.push_back(scheduler.Add([&] { counter++; }, &dependency, 1));
+        }
+
+        // Time executing the chain only. Each task makes the next one ready as it completes
+        Stopwatch stopwatch;
+        stopwatch.Start();
+        scheduler.GetContext().Run(throttler);
+        stopwatch.Stop();
+
+        results.Add(std::make_tuple(stopwatch.GetElapsedNanoseconds() / chainLength));
+    }
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(JoinBenchmark)
+{
+    using namespace Benchmarking;
+
+    int const iterationCount = 2000;
+
+    ResultTable<std::tuple<std::uint32_t, double, double>> results(
+        "Concurrency.TaskScheduler.Join",
+        1,
+        std::make_tuple("futures", "dependency task ns", "when all ns"));
+
+    TaskScheduler scheduler;
+    scheduler.Enter();
+    NullThrottler throttler;
+
+    for (std::uint32_t futureCount = 2; futureCount <= 32; futureCount *= 2)
+    {
+        std::vector<Future<void>> futures(futureCount);
+        std::vector<IWaitable*> dependencies(futureCount);
+
+        // Time joining pending futures and running them to completion, with the same tasks joined by both methods
+        double elapsed[2] = { 0, 0 };
+        for (int method = 0; method < 2; ++method)
+        {
+            for (int i = 0; i < iterationCount; ++i)
+            {
+                for (std::uint32_t f = 0; f < futureCount; ++f)
+                {
+                    futures[f] = scheduler.Add([] {});
+                    dependencies[f] = &futures[f];
+                }
+
+                Stopwatch stopwatch;
+                stopwatch.Start();
+                Future<void> joined = method == 0 ?
+                    scheduler.Add([] {}, &dependencies[0], futureCount) :
+                    WhenAll(scheduler, futures);
+                scheduler.GetContext().Run(throttler);
+                stopwatch.Stop();
+
+                BOOST_REQUIRE(joined.IsReady());
+                elapsed[method] += stopwatch.GetElapsedNanoseconds();
+            }
+        }
+
+        results.Add(std::make_tuple(futureCount, elapsed[0] / iterationCount, elapsed[1] / iterationCount));
+    }
+
+    scheduler.Leave();
+}
+
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+namespace
+{
+    // Sequence of steps written as tasks returning a future to continue with
+    Future<int> ContinuationSteps(TaskScheduler& scheduler, int remaining)
+    {
+        return scheduler.Add([&scheduler, remaining] () -> Future<int>
+        {
+            if (remaining == 0)
+                return scheduler.Add([] { return 0; });
+
+            return ContinuationSteps(scheduler, remaining - 1);
+        });
+    }
+
+    // Same sequence awaited from a coroutine
+    Coroutine<int> CoroutineSteps(TaskScheduler& scheduler, int count)
+    {
+        int result = 0;
+        for (int i = 0; i < count; ++i)
+            result += co_await scheduler.Add([] { return 0; });
+
+        co_return result;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CoroutineChainBenchmark)
+{
+    using namespace Benchmarking;
+
+    int const stepCount = 1 << 14;
+    int const sampleCount = 10;
+
+    ResultTable<std::tuple<double, double>> results(
+        "Concurrency.TaskScheduler.CoroutineChain",
+        1,
+        std::make_tuple("continuation ns per step", "coroutine ns per step"));
+
+    TaskScheduler scheduler;
+    scheduler.Enter();
+    NullThrottler throttler;
+
+    for (int sample = 0; sample < sampleCount; ++sample)
+    {
+        Stopwatch continuationStopwatch;
+        continuationStopwatch.Start();
+        Future<int> continuationResult = ContinuationSteps(scheduler, stepCount);
+        scheduler.GetContext().Run(throttler);
+        continuationStopwatch.Stop();
+        BOOST_REQUIRE(continuationResult.IsReady());
+
+        Stopwatch coroutineStopwatch;
+        coroutineStopwatch.Start();
+        Future<int> coroutineResult = scheduler.Add([&] { return CoroutineSteps(scheduler, stepCount); });
+        scheduler.GetContext().Run(throttler);
+        coroutineStopwatch.Stop();
+        BOOST_REQUIRE(coroutineResult.IsReady());
+
+        results.Add(std::make_tuple(
+            continuationStopwatch.GetElapsedNanoseconds() / stepCount,
+            coroutineStopwatch.GetElapsedNanoseconds() / stepCount));
+    }
+
+    scheduler.Leave();
+}
+#endif
+
+#if defined (CRUNCH_CONCURRENCY_HAS_FIBERS)
+BOOST_AUTO_TEST_CASE(FiberBenchmark)
+{
+    using namespace Benchmarking;
+
+    int const taskCount = 1 << 14;
+    int const depth = 1 << 10;
+    int const sampleCount = 10;
+
+    ResultTable<std::tuple<double, double, double>> results(
+        "Concurrency.TaskScheduler.Fiber",
+        1,
+        std::make_tuple("thread stack ns per task", "fiber ns per task", "fiber ns per waiting task"));
+
+    // Cost of running every task on a fiber, with no waiting, and of a chain of waiting tasks. The chain outgrows the
+    // pool of idle fibers, so it includes mapping a stack per task
+    TaskScheduler scheduler;
+    TaskScheduler::Config fiberConfig;
+    fiberConfig.useFibers = true;
+    TaskScheduler fiberScheduler(fiberConfig);
+    NullThrottler throttler;
+
+    for (int sample = 0; sample < sampleCount; ++sample)
+    {
+        double taskTimes[2];
+        TaskScheduler* schedulers[2] = { &scheduler, &fiberScheduler };
+        for (int i = 0; i < 2; ++i)
+        {
+            schedulers[i]->Enter();
+            Stopwatch stopwatch;
+            stopwatch.Start();
+            for (int task = 0; task < taskCount; ++task)
+                schedulers[i]->Add([] {});
+            schedulers[i]->GetContext().Run(throttler);
+            stopwatch.Stop();
+            taskTimes[i] = stopwatch.GetElapsedNanoseconds() / taskCount;
+            schedulers[i]->Leave();
+        }
+
+        fiberScheduler.Enter();
+        Stopwatch parkStopwatch;
+        parkStopwatch.Start();
+        Future<int> result = fiberScheduler.Add([&] { return Test::WaitingChain(fiberScheduler, depth); });
+        fiberScheduler.GetContext().Run(throttler);
+        parkStopwatch.Stop();
+        BOOST_REQUIRE(result.IsReady());
+        fiberScheduler.Leave();
+
+        results.Add(std::make_tuple(taskTimes[0], taskTimes[1], parkStopwatch.GetElapsedNanoseconds() / depth));
+    }
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
@@ -1,6 +1,8 @@
 // Copyright (c) 2011, Christian Rorvik
 // Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
 
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/thread.hpp"
 #include "crunch/concurrency/work_stealing_queue.hpp"
 
 #include "crunch/benchmarking/stopwatch.hpp"
@@ -9,8 +11,118 @@
 
 #include "crunch/test/framework.hpp"
 
+#include <memory>
+#include <vector>
+
 namespace Crunch { namespace Concurrency {
 
+namespace
+{
+    typedef WorkStealingQueue<int> IntQueue;
+
+    void SimulateWork(int amount)
+    {
+        for (volatile int i = 0; i < amount; ++i);
+    }
+
+    struct ContendedStealResult
+    {
+        double stealsPerStolenElement;
+        double nanosecondsPerElement;
+    };
+
+    // Owner pushes bursts of work onto its queue and processes them LIFO while thieves drain it from the front.
+    // Thieves only steal when their local queue is empty, so batch stealing shows up as fewer successful steal calls,
+    // i.e., fewer round-trips to the victim, per stolen element. Each element is still claimed with its own CAS
+    template<typename StealPolicy>
+    ContendedStealResult RunContendedSteal(int thiefCount, StealPolicy steal)
+    {
+        using namespace Benchmarking;
+
+        int const burstSize = 256;
+        int const burstCount = 1000;
+        int const workAmount = 100;
+
+        IntQueue victim;
+        Atomic<std::uint32_t> stolenCount(0);
+        Atomic<std::uint32_t> stealCount(0);
+        volatile bool done = false;
+
+        Stopwatch stopwatch;
+        stopwatch.Start();
+
+        std::vector<std::shared_ptr<Thread>> thieves;
+        for (int t = 0; t < thiefCount; ++t)
+        {
+            thieves.push_back(std::make_shared<Thread>([&, steal] {
+                IntQueue local;
+                std::uint32_t steals = 0;
+                std::uint32_t stolen = 0;
+                while (!done)
+                {
+                    if (local.Pop() == nullptr)
+                    {
+                        if (steal(victim, local) == nullptr)
+                            continue;
+                        steals++;
+                    }
+                    stolen++;
+                    SimulateWork(workAmount);
+                }
+
+                while (local.Pop() != nullptr)
+                    stolen++;
+
+                stealCount.Add(steals);
+                stolenCount.Add(stolen);
+            }));
+        }
+
+        std::uint32_t popped = 0;
+        for (int burst = 0; burst < burstCount; ++burst)
+        {
+            for (int i = 0; i < burstSize; ++i)
+                victim.Push(reinterpret_cast<int*>(static_cast<std::intptr_t>(i + 1)));
+
+            while (victim.Pop() != nullptr)
+            {
+                popped++;
+                SimulateWork(workAmount);
+            }
+        }
+
+        done = true;
+        for (std::size_t t = 0; t < thieves.size(); ++t)
+            thieves[t]->Join();
+
+        stopwatch.Stop();
+
+        BOOST_CHECK_EQUAL(popped + stolenCount.Load(), static_cast<std::uint32_t>(burstSize * burstCount));
+
+        ContendedStealResult result;
+        result.stealsPerStolenElement = stolenCount.Load() == 0 ? 0.0 : double(stealCount.Load()) / stolenCount.Load();
+        result.nanosecondsPerElement = stopwatch.GetElapsedNanoseconds() / (burstSize * burstCount);
+        return result;
+    }
+
+    template<typename StealPolicy>
+    void RunContendedStealBenchmark(char const* name, StealPolicy steal)
+    {
+        using namespace Benchmarking;
+
+        ResultTable<std::tuple<int, double, double>> results(
+            name,
+            1,
+            std::make_tuple("thieves", "steal calls per stolen element", "ns per element"));
+
+        for (int thiefCount = 1; thiefCount <= 3; ++thiefCount)
+        {
+            ContendedStealResult const result = RunContendedSteal(thiefCount, steal);
+            results.Add(std::make_tuple(thiefCount, result.stealsPerStolenElement, result.nanosecondsPerElement));
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE(WorkStealingQueueBenchmarks)
 
 BOOST_AUTO_TEST_CASE(UncontendedBenchmark)
@@ -51,6 +163,20 @@ BOOST_AUTO_TEST_CASE(UncontendedBenchmark)
         profiler.GetStdDev()));
 }
 
+BOOST_AUTO_TEST_CASE(ContendedStealBenchmark)
+{
+    RunContendedStealBenchmark("Concurrency.WorkStealingQueue.ContendedSteal", [] (IntQueue& victim, IntQueue&) {
+        return victim.Steal();
+    });
+}
+
+BOOST_AUTO_TEST_CASE(ContendedStealHalfBenchmark)
+{
+    RunContendedStealBenchmark("Concurrency.WorkStealingQueue.ContendedStealHalf", [] (IntQueue& victim, IntQueue& local) {
+        return victim.StealHalf(local);
+    });
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 }}
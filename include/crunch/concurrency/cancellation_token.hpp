@@ -0,0 +1,95 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_CANCELLATION_TOKEN_HPP
+#define CRUNCH_CONCURRENCY_CANCELLATION_TOKEN_HPP
+
+#include "crunch/concurrency/atomic.hpp"
+
+#include <cstdint>
+
+namespace Crunch { namespace Concurrency {
+
+// Shared flag for cooperatively cancelling a group of tasks. Copies refer to the same flag.
+// Tasks added with a token are skipped if it is cancelled before they start, completing their future in the cancelled state.
+// Tasks added while running a task with a token inherit it, so cancelling drops the whole subtree spawned from it.
+// Running tasks are not interrupted, but can poll IsCancelled() to stop early.
+class CancellationToken
+{
+public:
+    // Null token, which can never be cancelled
+    CancellationToken()
+        : mState(nullptr)
+    {}
+
+    static CancellationToken Create()
+    {
+        return CancellationToken(new State());
+    }
+
+    CancellationToken(CancellationToken const& rhs)
+        : mState(rhs.mState)
+    {
+        if (mState)
+            mState->refCount.Increment(MEMORY_ORDER_RELAXED);
+    }
+
+    CancellationToken& operator = (CancellationToken const& rhs)
+    {
+        CancellationToken(rhs).Swap(*this);
+        return *this;
+    }
+
+    ~CancellationToken()
+    {
+        if (mState && mState->refCount.Decrement(MEMORY_ORDER_ACQ_REL) == 1)
+            delete mState;
+    }
+
+    void Swap(CancellationToken& rhs)
+    {
+        State* state = mState;
+        mState = rhs.mState;
+        rhs.mState = state;
+    }
+
+    bool IsSet() const
+    {
+        return mState != nullptr;
+    }
+
+    // Has no effect on a null token
+    void Cancel()
+    {
+        if (mState)
+            mState->cancelled.Store(1, MEMORY_ORDER_RELEASE);
+    }
+
+    // A single relaxed load, cheap enough to poll from inner loops
+    bool IsCancelled() const
+    {
+        return mState && mState->cancelled.Load(MEMORY_ORDER_RELAXED) != 0;
+    }
+
+private:
+    struct State
+    {
+        State()
+            : refCount(1)
+            , cancelled(0)
+        {}
+
+        Atomic<std::uint32_t> refCount;
+        Atomic<std::uint32_t> cancelled;
+    };
+
+    explicit CancellationToken(State* state)
+        : mState(state)
+    {}
+
+    State* mState;
+};
+
+}}
+
+#endif
@@ -0,0 +1,328 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_COROUTINE_HPP
+#define CRUNCH_CONCURRENCY_COROUTINE_HPP
+
+#include "crunch/concurrency/task_scheduler.hpp"
+
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+
+#include "crunch/concurrency/detail/coroutine_resume_task.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace Crunch { namespace Concurrency {
+
+namespace Detail
+{
+    class CoroutinePromiseBase
+    {
+    public:
+        CoroutinePromiseBase()
+            : mResumeTask(nullptr)
+        {}
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                // Continue the awaiting coroutine by symmetric transfer, without growing the stack
+                Promise& promise = handle.promise();
+                if (promise.mContinuation)
+                    return promise.mContinuation;
+
+                // Outermost coroutine. Completes the future and destroys the chain
+                promise.CompleteRoot();
+                return std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        // Frames are allocated from the task allocator of the creating thread
+        static void* operator new(std::size_t size)
+        {
+            std::uint32_t allocationSize = static_cast<std::uint32_t>(size);
+            return TaskScheduler::AllocateFrame(allocationSize);
+        }
+
+        static void operator delete(void* frame, std::size_t size)
+        {
+            TaskScheduler::FreeTask(frame, TaskAllocator::GetAllocationSize(static_cast<std::uint32_t>(size)));
+        }
+
+        // Coroutines only run once started by a task or awaited
+        std::suspend_always initial_suspend() noexcept
+        {
+            return std::suspend_always();
+        }
+
+        FinalAwaiter final_suspend() noexcept
+        {
+            return FinalAwaiter();
+        }
+
+        // As with other tasks, exceptions are not propagated
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+
+        std::coroutine_handle<> mContinuation; // Coroutine awaiting this one. Null for the outermost
+        CoroutineResumeTaskBase* mResumeTask; // Shared by the chain. Set when started
+    };
+
+    template<typename T>
+    class CoroutinePromise : public CoroutinePromiseBase
+    {
+    public:
+        Coroutine<T> get_return_object()
+        {
+            return Coroutine<T>(std::coroutine_handle<CoroutinePromise>::from_promise(*this));
+        }
+
+        template<typename U>
+        void return_value(U&& value)
+        {
+            mResult.emplace(std::forward<U>(value));
+        }
+
+        T TakeResult()
+        {
+            return std::move(*mResult);
+        }
+
+        void CompleteRoot()
+        {
+            static_cast<CoroutineResumeTask<T>*>(mResumeTask)->Complete(std::move(*mResult));
+        }
+
+    private:
+        std::optional<T> mResult;
+    };
+
+    template<>
+    class CoroutinePromise<void> : public CoroutinePromiseBase
+    {
+    public:
+        Coroutine<void> get_return_object();
+
+        void return_void() {}
+
+        void TakeResult() {}
+
+        void CompleteRoot()
+        {
+            static_cast<CoroutineResumeTask<void>*>(mResumeTask)->Complete();
+        }
+    };
+
+    template<typename T>
+    class FutureAwaiter
+    {
+    public:
+        explicit FutureAwaiter(Future<T> const& future)
+            : mFuture(future)
+        {}
+
+        bool await_ready() const
+        {
+            return mFuture.IsReady();
+        }
+
+        // Suspend onto the future's waiters. Continues without suspending if it became ready in the meantime
+        template<typename Promise>
+        bool await_suspend(std::coroutine_handle<Promise> handle)
+        {
+            // Futures are handles to shared state, so waiting on a const future is harmless
+            return handle.promise().mResumeTask->ResumeWhenReady(handle, const_cast<Future<T>&>(mFuture));
+        }
+
+        auto await_resume() const -> decltype(std::declval<Future<T> const&>().Get())
+        {
+            return mFuture.Get();
+        }
+
+    private:
+        Future<T> const& mFuture;
+    };
+}
+
+// Lazily started coroutine, run as a task by returning it from a task added to a TaskScheduler, or by co_await from
+// another coroutine. The future of the task completes with the value of co_return.
+// Frames come from the task allocator, and the chain of coroutines run by a task is resumed by a single task re-queued
+// each time it suspends on a future, so suspending and resuming costs no allocation. Awaiting another coroutine
+// transfers control to it directly, and back once it completes.
+// Only co_await futures and coroutines. The token of the task is inherited by tasks added from the coroutines, and
+// cancelling it destroys the chain at the next resumption.
+//
+//   Coroutine<int> Sum(TaskScheduler& scheduler)
+//   {
+//       int const a = co_await scheduler.Add([] { return 1; });
+//       int const b = co_await Sum2(scheduler);
+//       co_return a + b;
+//   }
+//
+//   Future<int> sum = scheduler.Add([&] { return Sum(scheduler); });
+template<typename T = void>
+class Coroutine
+{
+public:
+    typedef Detail::CoroutinePromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> HandleType;
+
+    class Awaiter
+    {
+    public:
+        explicit Awaiter(HandleType handle)
+            : mHandle(handle)
+        {}
+
+        bool await_ready() const
+        {
+            return false;
+        }
+
+        // Start the awaited coroutine as part of the same chain
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting)
+        {
+            promise_type& promise = mHandle.promise();
+            promise.mContinuation = awaiting;
+            promise.mResumeTask = awaiting.promise().mResumeTask;
+            return mHandle;
+        }
+
+        T await_resume()
+        {
+            return mHandle.promise().TakeResult();
+        }
+
+    private:
+        HandleType mHandle;
+    };
+
+    Coroutine(Coroutine&& rhs)
+        : mHandle(rhs.mHandle)
+    {
+        rhs.mHandle = nullptr;
+    }
+
+    Coroutine& operator = (Coroutine&& rhs)
+    {
+        Coroutine(std::move(rhs)).Swap(*this);
+        return *this;
+    }
+
+    ~Coroutine()
+    {
+        if (mHandle)
+            mHandle.destroy();
+    }
+
+    void Swap(Coroutine& rhs)
+    {
+        std::swap(mHandle, rhs.mHandle);
+    }
+
+    // Awaiting coroutines must be temporaries, e.g., co_await Child(), or moved from
+    Awaiter operator co_await() &&
+    {
+        return Awaiter(mHandle);
+    }
+
+    // Give up ownership of the frame, to be started by the scheduler
+    HandleType Release()
+    {
+        HandleType const handle = mHandle;
+        mHandle = nullptr;
+        return handle;
+    }
+
+private:
+    friend class Detail::CoroutinePromise<T>;
+
+    explicit Coroutine(HandleType handle)
+        : mHandle(handle)
+    {}
+
+    Coroutine(Coroutine const&);
+    Coroutine& operator = (Coroutine const&);
+
+    HandleType mHandle;
+};
+
+// Suspend a coroutine until future is ready, resuming as a task queued by whoever makes it ready
+template<typename T>
+Detail::FutureAwaiter<T> operator co_await(Future<T> const& future)
+{
+    return Detail::FutureAwaiter<T>(future);
+}
+
+namespace Detail
+{
+    inline Coroutine<void> CoroutinePromise<void>::get_return_object()
+    {
+        return Coroutine<void>(std::coroutine_handle<CoroutinePromise>::from_promise(*this));
+    }
+
+    template<typename F>
+    void ScheduledTask<F>::Dispatch(TaskResultClassCoroutine, TaskCallClassVoid)
+    {
+        typedef CoroutineResumeTask<ResultType> ResumeTaskType;
+
+        auto const coroutine = mFunctor().Release();
+
+        // The coroutine takes over the future, and is resumed by a task taking the place of this one
+        typename ResumeTaskType::FutureDataType* const futureData = static_cast<typename ResumeTaskType::FutureDataType*>(mFutureData);
+        std::uint32_t const allocSize = mAllocationSize;
+        bool const ownsAllocation = mOwnsAllocation;
+        TaskPriority const priority = mPriority;
+        TaskScheduler& owner = mOwner;
+        CancellationToken cancellation;
+        cancellation.Swap(mCancellation);
+
+        ResumeTaskType* resumeTask;
+        if (allocSize >= sizeof(ResumeTaskType))
+        {
+            // Reuse current allocation
+            this->~ScheduledTask<F>();
+            resumeTask = new (this) ResumeTaskType(owner, coroutine, futureData, allocSize, ownsAllocation);
+        }
+        else
+        {
+            Destroy();
+            std::uint32_t resumeAllocSize = sizeof(ResumeTaskType);
+            void* const allocation = Allocate(owner, resumeAllocSize);
+            resumeTask = new (allocation) ResumeTaskType(owner, coroutine, futureData, resumeAllocSize, true);
+        }
+
+        resumeTask->mPriority = priority;
+        resumeTask->mCancellation.Swap(cancellation);
+        coroutine.promise().mContinuation = nullptr;
+        coroutine.promise().mResumeTask = resumeTask;
+
+        // Started as the next task, as this task's token, referenced while dispatching it, is gone.
+        // Usually handed off to run right after this returns
+        resumeTask->Enque();
+    }
+}
+
+}}
+
+#endif
+
+#endif
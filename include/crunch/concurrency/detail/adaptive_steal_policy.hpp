@@ -0,0 +1,125 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_ADAPTIVE_STEAL_POLICY_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_ADAPTIVE_STEAL_POLICY_HPP
+
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/concurrency/atomic.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Decides how long a context keeps trying to steal before going idle, and how long it backs off between attempts.
+// Loosely after A-STEAL (Agrawal, He, Leiserson), adapting to feedback rather than using fixed constants:
+// - The attempt budget grows multiplicatively when work shows up shortly after going idle,
+//   as spinning longer would have avoided the cost of parking and waking. It shrinks when idle periods are long,
+//   so contexts with sparse work park quickly.
+// - The backoff between attempts scales with the recent steal failure rate,
+//   so steals are retried eagerly while they tend to succeed.
+//
+// Updated by the owning context only. State is published with relaxed atomics to allow observation from other threads.
+class AdaptiveStealPolicy : NonCopyable
+{
+public:
+    // Idle periods shorter than this should have been spent spinning. Roughly the cost of a park and wake up
+    static std::uint64_t const ShortIdleNanoseconds = 50 * 1000;
+
+    // Idle periods longer than this should have been spent parked
+    static std::uint64_t const LongIdleNanoseconds = 8 * ShortIdleNanoseconds;
+
+    static std::uint32_t const MaxBackoff = 256;
+
+    // Fixed point scale of success rate
+    static std::uint32_t const RateOne = 1 << 10;
+
+    AdaptiveStealPolicy(std::uint32_t minAttemptBudget, std::uint32_t maxAttemptBudget)
+        : mMinAttemptBudget(std::max<std::uint32_t>(minAttemptBudget, 1))
+        , mMaxAttemptBudget(std::max(maxAttemptBudget, mMinAttemptBudget))
+        , mIdleStart(0)
+        , mAttemptBudget(std::min(std::max<std::uint32_t>(20, mMinAttemptBudget), mMaxAttemptBudget))
+        , mSuccessRate(RateOne / 2)
+        , mMeanIdleNanoseconds(0)
+    {}
+
+    // Number of consecutive failed steal attempts before going idle
+    std::uint32_t GetAttemptBudget() const
+    {
+        return mAttemptBudget.Load(MEMORY_ORDER_RELAXED);
+    }
+
+    // Number of pause iterations to wait before the next attempt, after failedAttempts consecutive failures
+    std::uint32_t GetBackoff(std::uint32_t failedAttempts) const
+    {
+        std::uint32_t const limit = GetBackoffLimit();
+        return failedAttempts >= 31 ? limit : std::min(limit, (1u << failedAttempts) - 1);
+    }
+
+    std::uint32_t GetBackoffLimit() const
+    {
+        return 1 + ((MaxBackoff - 1) * (RateOne - GetSuccessRate())) / RateOne;
+    }
+
+    // Exponentially weighted average of steal attempts succeeding, in [0, RateOne]
+    std::uint32_t GetSuccessRate() const
+    {
+        return mSuccessRate.Load(MEMORY_ORDER_RELAXED);
+    }
+
+    // Exponentially weighted average of time from going idle until finding work
+    std::uint64_t GetMeanIdleNanoseconds() const
+    {
+        return mMeanIdleNanoseconds.Load(MEMORY_ORDER_RELAXED);
+    }
+
+    void OnStealAttempt(bool succeeded)
+    {
+        std::uint32_t const rate = GetSuccessRate();
+        std::uint32_t const newRate = succeeded ? rate + (RateOne - rate) / 16 : rate - rate / 16;
+        mSuccessRate.Store(newRate, MEMORY_ORDER_RELAXED);
+    }
+
+    // Attempt budget exhausted. now is a monotonic timestamp in nanoseconds
+    void OnIdle(std::uint64_t now)
+    {
+        // Keep the first timestamp if waking up without finding work
+        if (mIdleStart == 0)
+            mIdleStart = now;
+    }
+
+    bool IsIdle() const
+    {
+        return mIdleStart != 0;
+    }
+
+    // Work found after having been idle
+    void OnWorkFound(std::uint64_t now)
+    {
+        std::uint64_t const idleTime = now > mIdleStart ? now - mIdleStart : 0;
+        mIdleStart = 0;
+
+        std::uint64_t const mean = GetMeanIdleNanoseconds();
+        mMeanIdleNanoseconds.Store(mean == 0 ? idleTime : mean - mean / 8 + idleTime / 8, MEMORY_ORDER_RELAXED);
+
+        std::uint32_t const budget = GetAttemptBudget();
+        if (idleTime < ShortIdleNanoseconds)
+            mAttemptBudget.Store(std::min(budget * 2, mMaxAttemptBudget), MEMORY_ORDER_RELAXED);
+        else if (idleTime > LongIdleNanoseconds)
+            mAttemptBudget.Store(std::max(budget / 2, mMinAttemptBudget), MEMORY_ORDER_RELAXED);
+    }
+
+private:
+    std::uint32_t const mMinAttemptBudget;
+    std::uint32_t const mMaxAttemptBudget;
+    std::uint64_t mIdleStart;
+
+    Atomic<std::uint32_t> mAttemptBudget;
+    Atomic<std::uint32_t> mSuccessRate;
+    Atomic<std::uint64_t> mMeanIdleNanoseconds;
+};
+
+}}}
+
+#endif
@@ -0,0 +1,123 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_COROUTINE_RESUME_TASK_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_COROUTINE_RESUME_TASK_HPP
+
+#include "crunch/base/override.hpp"
+#include "crunch/concurrency/tasks_api.hpp"
+
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+
+#include "crunch/concurrency/waitable.hpp"
+#include "crunch/concurrency/detail/scheduled_task.hpp"
+#include "crunch/concurrency/detail/task_future_data.hpp"
+
+#include <coroutine>
+#include <cstdint>
+#include <utility>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Task resuming the chain of coroutines started by a task returning a Coroutine<T>, i.e., the returned coroutine
+// and any coroutines it awaits in turn. Takes the place of the returning task in its block, along with its reference
+// to the future data, which is completed by the outermost coroutine.
+// Queued whenever a future awaited by the innermost coroutine becomes ready, so resumption goes through hand-off
+// and the work stealing queues like any other task, without allocating.
+class CoroutineResumeTaskBase : public ScheduledTaskBase
+{
+public:
+    struct ReadyWaiter : Waiter
+    {
+        explicit ReadyWaiter(CoroutineResumeTaskBase* task)
+            : Waiter(&Notify)
+            , task(task)
+        {}
+
+        static void Notify(Waiter* waiter)
+        {
+            static_cast<ReadyWaiter*>(waiter)->task->Enque();
+        }
+
+        CoroutineResumeTaskBase* task;
+    };
+
+    CoroutineResumeTaskBase(TaskScheduler& owner, std::coroutine_handle<> root, std::uint32_t allocationSize, bool ownsAllocation)
+        : ScheduledTaskBase(owner, 0, allocationSize, ownsAllocation)
+        , mRoot(root)
+        , mResumeHandle(root)
+        , mReadyWaiter(this)
+    {}
+
+    virtual void Dispatch() CRUNCH_OVERRIDE
+    {
+        // The chain may complete and destroy this task, or suspend and be resumed on another thread, before resume() returns
+        mResumeHandle.resume();
+    }
+
+    // Queue handle for resumption once waitable is ready. Returns false if it already is, and the caller should continue.
+    // Otherwise the coroutine may be resumed by another thread as soon as this returns, and must be treated as suspended
+    bool ResumeWhenReady(std::coroutine_handle<> handle, IWaitable& waitable)
+    {
+        mResumeHandle = handle;
+        return waitable.AddWaiter(static_cast<Waiter*>(&mReadyWaiter));
+    }
+
+protected:
+    std::coroutine_handle<> mRoot; // Outermost coroutine, owning the frames of those it awaits
+    std::coroutine_handle<> mResumeHandle; // Innermost suspended coroutine
+    ReadyWaiter mReadyWaiter;
+};
+
+template<typename T>
+class CoroutineResumeTask : public CoroutineResumeTaskBase
+{
+public:
+    typedef TaskFutureData<T> FutureDataType;
+
+    // Takes over a reference to futureData
+    CoroutineResumeTask(TaskScheduler& owner, std::coroutine_handle<> root, FutureDataType* futureData, std::uint32_t allocationSize, bool ownsAllocation)
+        : CoroutineResumeTaskBase(owner, root, allocationSize, ownsAllocation)
+        , mFutureData(futureData)
+    {}
+
+    virtual void Cancel() CRUNCH_OVERRIDE
+    {
+        // Only queued while the chain is suspended. Destroying the outermost frame destroys the frames it awaits
+        FutureDataType* const futureData = mFutureData;
+        mRoot.destroy();
+        futureData->SetCancelled();
+        Destroy();
+        Release(futureData);
+    }
+
+    // Called by the outermost coroutine on final suspension, with the result stored in its frame
+    template<typename... Args>
+    void Complete(Args&&... result)
+    {
+        // Complete before destroying the token of this task, which is referenced by the context while dispatching
+        FutureDataType* const futureData = mFutureData;
+        futureData->Set(std::forward<Args>(result)...);
+        mRoot.destroy();
+        Destroy();
+        Release(futureData);
+    }
+
+private:
+    void Destroy()
+    {
+        std::uint32_t const allocationSize = mAllocationSize;
+        bool const ownsAllocation = mOwnsAllocation;
+        this->~CoroutineResumeTask<T>();
+        if (ownsAllocation)
+            Free(this, allocationSize);
+    }
+
+    FutureDataType* mFutureData;
+};
+
+}}}
+
+#endif
+
+#endif
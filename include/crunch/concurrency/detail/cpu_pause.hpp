@@ -0,0 +1,29 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_CPU_PAUSE_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_CPU_PAUSE_HPP
+
+#include "crunch/base/platform.hpp"
+
+#if defined (CRUNCH_ARCH_X86)
+#   if defined (CRUNCH_COMPILER_MSVC)
+#       include <intrin.h>
+#   else
+#       include <emmintrin.h>
+#   endif
+#endif
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Spin wait hint. Frees execution resources for an SMT sibling and avoids memory order violation penalties when leaving the spin loop
+inline void CpuPause()
+{
+#if defined (CRUNCH_ARCH_X86)
+    _mm_pause();
+#endif
+}
+
+}}}
+
+#endif
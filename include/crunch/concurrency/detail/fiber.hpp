@@ -0,0 +1,86 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_FIBER_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_FIBER_HPP
+
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/base/platform.hpp"
+#include "crunch/concurrency/tasks_api.hpp"
+
+#include <cstddef>
+
+#if defined (CRUNCH_PLATFORM_LINUX)
+#   define CRUNCH_CONCURRENCY_HAS_FIBERS
+#   if !defined (CRUNCH_ARCH_X86_64)
+#       include <ucontext.h>
+#   endif
+#endif
+
+#if defined (CRUNCH_CONCURRENCY_HAS_FIBERS)
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Saved execution state of a fiber, or of a thread while it has switched to a fiber.
+// Default constructed for the calling thread
+class FiberContext : NonCopyable
+{
+public:
+    CRUNCH_CONCURRENCY_TASKS_API FiberContext();
+
+private:
+    friend class Fiber;
+    friend CRUNCH_CONCURRENCY_TASKS_API void SwitchFiber(FiberContext& from, FiberContext& to);
+    friend struct FiberSwitch;
+
+#if defined (CRUNCH_ARCH_X86_64)
+    void* mStackPointer; // Callee saved registers are kept on the stack
+#else
+    ucontext_t mContext;
+#endif
+
+    // Stack bounds and handle for sanitizers, which must be told about stack switches. Unknown for threads until first switched from
+    void* mStackBottom;
+    std::size_t mStackSize;
+    void* mSanitizerFiber;
+};
+
+// Execution context with its own stack, mapped with an inaccessible guard page below it, so overflowing the stack
+// faults instead of corrupting memory. Switching costs a handful of register saves and restores on x86-64, and a
+// ucontext switch, including a signal mask system call, elsewhere
+class Fiber : NonCopyable
+{
+public:
+    typedef void (*EntryFunction)(void* argument);
+
+    // entry is run on the first switch to the fiber, and must never return.
+    // stackSize is rounded up to whole pages
+    CRUNCH_CONCURRENCY_TASKS_API Fiber(std::size_t stackSize, EntryFunction entry, void* argument);
+
+    // Must not be running. Any frames on the stack are discarded without running destructors
+    CRUNCH_CONCURRENCY_TASKS_API ~Fiber();
+
+    FiberContext& GetContext()
+    {
+        return mContext;
+    }
+
+private:
+    friend struct FiberSwitch;
+
+    FiberContext mContext;
+    void* mMapping;
+    std::size_t mMappingSize;
+    EntryFunction mEntry;
+    void* mArgument;
+};
+
+// Save the calling execution state in from and continue from to. Returns once something switches back to from,
+// possibly on another thread
+CRUNCH_CONCURRENCY_TASKS_API void SwitchFiber(FiberContext& from, FiberContext& to);
+
+}}}
+
+#endif
+
+#endif
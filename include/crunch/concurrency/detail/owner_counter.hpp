@@ -0,0 +1,50 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_OWNER_COUNTER_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_OWNER_COUNTER_HPP
+
+#include "crunch/concurrency/atomic.hpp"
+
+#include <cstdint>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Statistics counter updated by a single owning thread and sampled by any thread.
+// Updates are a plain load and store, without the cost of an atomic read-modify-write
+class OwnerCounter
+{
+public:
+    OwnerCounter()
+        : mValue(0)
+    {}
+
+    void Increment()
+    {
+        Add(1);
+    }
+
+    void Add(std::uint64_t value)
+    {
+        mValue.Store(mValue.Load(MEMORY_ORDER_RELAXED) + value, MEMORY_ORDER_RELAXED);
+    }
+
+    // Raise to value if larger
+    void Max(std::uint64_t value)
+    {
+        if (value > mValue.Load(MEMORY_ORDER_RELAXED))
+            mValue.Store(value, MEMORY_ORDER_RELAXED);
+    }
+
+    std::uint64_t Get() const
+    {
+        return mValue.Load(MEMORY_ORDER_RELAXED);
+    }
+
+private:
+    Atomic<std::uint64_t> mValue;
+};
+
+}}}
+
+#endif
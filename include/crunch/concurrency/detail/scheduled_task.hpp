@@ -9,8 +9,14 @@
 #include "crunch/base/override.hpp"
 
 #include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/cancellation_token.hpp"
+#include "crunch/concurrency/task_affinity.hpp"
+#include "crunch/concurrency/task_priority.hpp"
+#include "crunch/concurrency/detail/task_future_data.hpp"
 #include "crunch/concurrency/detail/task_result.hpp"
 
+#include <utility>
+
 namespace Crunch { namespace Concurrency {
 
 class TaskScheduler;
@@ -28,14 +34,21 @@ class CRUNCH_NOVTABLE ScheduledTaskBase : NonCopyable
 public:
     friend class TaskScheduler;
 
-    ScheduledTaskBase(TaskScheduler& owner, std::uint32_t barrierCount, std::uint32_t allocationSize)
+    ScheduledTaskBase(TaskScheduler& owner, std::uint32_t barrierCount, std::uint32_t allocationSize, bool ownsAllocation)
         : mOwner(owner)
         , mBarrierCount(barrierCount, MEMORY_ORDER_RELEASE)
         , mAllocationSize(allocationSize)
+        , mOwnsAllocation(ownsAllocation)
+        , mResumesFiber(false)
+        , mPriority(TASK_PRIORITY_NORMAL)
+        , mNext(nullptr)
     {}
 
     virtual void Dispatch() = 0;
 
+    // Destroy the task without running it, completing its future in the cancelled state
+    virtual void Cancel() = 0;
+
     void NotifyDependencyReady()
     {
         if (1 == mBarrierCount.Decrement())
@@ -44,11 +57,31 @@ public:
 
     void Enque();
 
+    // Allocate task memory from the calling thread's context. allocationSize is updated to the size actually allocated
+    static void* Allocate(TaskScheduler& owner, std::uint32_t& allocationSize);
+    static void Free(void* allocation, std::uint32_t allocationSize);
+
     TaskScheduler& mOwner;
     Atomic<std::uint32_t> mBarrierCount;
-    std::uint32_t mAllocationSize;
+    std::uint32_t mAllocationSize; // Space available to the task, including any continuation re-using it
+    bool mOwnsAllocation; // False when co-allocated with future data, which then owns the memory
+    bool mResumesFiber; // Resumes a task suspended on a fiber, rather than being run on one. See TaskScheduler::Config::useFibers
+    TaskPriority mPriority;
+    TaskAffinity mAffinity; // Not inherited by continuations
+    CancellationToken mCancellation; // Inherited by continuations and tasks added while running
+    ScheduledTaskBase* mNext; // Intrusive link for TaskScheduler injection queue and context mailboxes
 };
 
+inline void SetNext(ScheduledTaskBase& task, ScheduledTaskBase* next)
+{
+    task.mNext = next;
+}
+
+inline ScheduledTaskBase* GetNext(ScheduledTaskBase& task)
+{
+    return task.mNext;
+}
+
 template<typename F>
 class ScheduledTask : public ScheduledTaskBase
 {
@@ -60,11 +93,15 @@ public:
     typedef typename FutureType::DataType FutureDataType;
     typedef typename FutureType::DataPtr FutureDataPtr;
 
-    // futureData must have 1 ref count already added
-    ScheduledTask(TaskScheduler& owner, F&& f, FutureDataType* futureData, std::uint32_t barrierCount, std::uint32_t allocationSize = sizeof(ScheduledTask<F>))
-        : ScheduledTaskBase(owner, barrierCount, allocationSize)
+    // futureData must have 1 ref count already added, which is released on completion
+    // allocationSize is the space available at the task address.
+    // If ownsAllocation is set, the space is a block returned by Allocate() and is freed when the task is destroyed
+    // f is moved in if an rvalue, so move-only functors can be scheduled
+    template<typename G>
+    ScheduledTask(TaskScheduler& owner, G&& f, FutureDataType* futureData, std::uint32_t barrierCount, std::uint32_t allocationSize, bool ownsAllocation)
+        : ScheduledTaskBase(owner, barrierCount, allocationSize, ownsAllocation)
         , mFutureData(futureData) 
-        , mFunctor(std::move(f))
+        , mFunctor(std::forward<G>(f))
     {
         CRUNCH_ASSERT(futureData->GetRefCount() > 0);
     }
@@ -74,22 +111,44 @@ public:
         Dispatch(typename Traits::ResultClass(), typename Traits::CallClass());
     }
 
+    virtual void Cancel() CRUNCH_OVERRIDE
+    {
+        // All future data of scheduled tasks is created by the scheduler, as TaskFutureData
+        FutureDataType* futureData = mFutureData;
+        static_cast<TaskFutureData<ResultType>*>(futureData)->SetCancelled();
+        Destroy();
+        Release(futureData);
+    }
+
+    // Destroy task and release its memory if owned.
+    // Future data must be released after this, as it might own the task memory
+    void Destroy()
+    {
+        std::uint32_t const allocationSize = mAllocationSize;
+        bool const ownsAllocation = mOwnsAllocation;
+        this->~ScheduledTask<F>();
+        if (ownsAllocation)
+            Free(this, allocationSize);
+    }
+
 private:
     friend class ScheduledTaskExecutionContext<F>;
 
     void Dispatch(TaskResultClassGeneric, TaskCallClassVoid)
     {
-        mFutureData->Set(mFunctor());
-        Release(mFutureData);
-        delete this;
+        FutureDataType* futureData = mFutureData;
+        futureData->Set(mFunctor());
+        Destroy();
+        Release(futureData);
     }
 
     void Dispatch(TaskResultClassVoid, TaskCallClassVoid)
     {
         mFunctor();
-        mFutureData->Set();
-        Release(mFutureData);
-        delete this;
+        FutureDataType* futureData = mFutureData;
+        futureData->Set();
+        Destroy();
+        Release(futureData);
     }
 
     void Dispatch(TaskResultClassVoid, TaskCallClassExecutionContext);
@@ -98,6 +157,11 @@ private:
 
     void Dispatch(TaskResultClassFuture, TaskCallClassExecutionContext);
 
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+    // Defined in crunch/concurrency/coroutine.hpp
+    void Dispatch(TaskResultClassCoroutine, TaskCallClassVoid);
+#endif
+
     // typedef typename std::aligned_storage<sizeof(F), std::alignment_of<F>::value>::type FunctorStorageType;
 
     FutureDataType* mFutureData;
@@ -105,6 +169,40 @@ private:
     // FunctorStorageType mFunctorStorage;
 };
 
+// Task without a future, for work whose completion is tracked by other means, e.g., a join counter.
+// Owns its allocation, which is freed once the task has run or been cancelled
+template<typename F>
+class DetachedTask : public ScheduledTaskBase
+{
+public:
+    template<typename G>
+    DetachedTask(TaskScheduler& owner, G&& f, std::uint32_t allocationSize)
+        : ScheduledTaskBase(owner, 0, allocationSize, true)
+        , mFunctor(std::forward<G>(f))
+    {}
+
+    virtual void Dispatch() CRUNCH_OVERRIDE
+    {
+        mFunctor();
+        Destroy();
+    }
+
+    virtual void Cancel() CRUNCH_OVERRIDE
+    {
+        Destroy();
+    }
+
+private:
+    void Destroy()
+    {
+        std::uint32_t const allocationSize = mAllocationSize;
+        this->~DetachedTask<F>();
+        Free(this, allocationSize);
+    }
+
+    F mFunctor;
+};
+
 template<typename F>
 void ScheduledTask<F>::Dispatch(TaskResultClassFuture, TaskCallClassVoid)
 {
@@ -113,27 +211,37 @@ void ScheduledTask<F>::Dispatch(TaskResultClassFuture, TaskCallClassVoid)
     // Create continuation dependent on the completion of the returned Future
     auto futureData = mFutureData;
     std::uint32_t const allocSize = mAllocationSize;
+    bool const ownsAllocation = mOwnsAllocation;
+    TaskPriority const priority = mPriority;
     TaskScheduler& owner = mOwner;
+    CancellationToken cancellation;
+    cancellation.Swap(mCancellation);
 
     // Get value from result
-    auto contFunc = [=] () -> ResultType { return result.Get(); };
-    typedef ScheduledTask<decltype(contFunc)> ContTaskType;
+    typedef FutureValueFunctor<ResultType> ContFuncType;
+    typedef ScheduledTask<ContFuncType> ContTaskType;
+    ContFuncType contFunc(result);
 
     ContTaskType* contTask;
     // TODO: statically guarantee sufficient space for continuation in any task returning a Future<T>
-    if (sizeof(ScheduledTask<F>) >= sizeof(ContTaskType) || allocSize >= sizeof(ContTaskType))
+    if (allocSize >= sizeof(ContTaskType))
     {
         // Reuse current allocation
         this->~ScheduledTask<F>();
-        contTask = new (this) ContTaskType(owner, std::move(contFunc), futureData, 1, allocSize);
+        contTask = new (this) ContTaskType(owner, std::move(contFunc), futureData, 1, allocSize, ownsAllocation);
     }
     else
     {
         // Create new allocation
-        delete this;
-        contTask = new ContTaskType(owner, std::move(contFunc), futureData, 1);
+        Destroy();
+        std::uint32_t contAllocSize = sizeof(ContTaskType);
+        void* const allocation = Allocate(owner, contAllocSize);
+        contTask = new (allocation) ContTaskType(owner, std::move(contFunc), futureData, 1, contAllocSize, true);
     }
 
+    contTask->mPriority = priority;
+    contTask->mCancellation.Swap(cancellation);
+
     if (!result.AddWaiter([=] { contTask->NotifyDependencyReady(); }))
         contTask->NotifyDependencyReady();
 }
@@ -18,27 +18,30 @@ class ScheduledTaskExecutionContext : public TaskExecutionContext<typename Resul
 {
 public:
     ScheduledTaskExecutionContext(ScheduledTask<F>* owner)
-        : TaskExecutionContext<typename ResultOfTask<F>::Type>(owner->mOwner, owner->mFutureData)
+        : TaskExecutionContext<typename ResultOfTask<F>::Type>(owner->mOwner, owner->mFutureData, owner->mPriority, owner->mCancellation)
         , mOwner(owner)
     {}
 
-    virtual void* AllocateContinuation(std::size_t requiredSize) CRUNCH_OVERRIDE
+    virtual void* AllocateContinuation(std::uint32_t& allocationSize, bool& ownsAllocation) CRUNCH_OVERRIDE
     {
-        // Cache allocation size before destroying object
-        const std::size_t allocationSize = mOwner->mAllocationSize;
+        // Cache allocation info before destroying object
+        std::uint32_t const ownerAllocationSize = mOwner->mAllocationSize;
+        bool const ownerOwnsAllocation = mOwner->mOwnsAllocation;
 
         // Re-use object memory if possible
-        if (allocationSize >= requiredSize)
+        if (ownerAllocationSize >= allocationSize)
         {
-            // TODO: Need to return size of allocation
-            //       Or special constructor which doesn't overwrite previous fields...
             mOwner->~ScheduledTask<F>();
+            allocationSize = ownerAllocationSize;
+            ownsAllocation = ownerOwnsAllocation;
             return mOwner;
         }
         else
         {
-            delete mOwner;
-            return new char[requiredSize];
+            TaskScheduler& owner = mOwner->mOwner;
+            mOwner->Destroy();
+            ownsAllocation = true;
+            return ScheduledTaskBase::Allocate(owner, allocationSize);
         }
     }
 
@@ -55,9 +58,10 @@ void ScheduledTask<F>::Dispatch(TaskResultClassVoid, TaskCallClassExecutionConte
 
     if (!execContext.mHasContinuation)
     {
-        mFutureData->Set();
-        Release(mFutureData);
-        delete this;
+        FutureDataType* futureData = mFutureData;
+        futureData->Set();
+        Destroy();
+        Release(futureData);
     }
 }
 
@@ -75,27 +79,37 @@ void ScheduledTask<F>::Dispatch(TaskResultClassFuture, TaskCallClassExecutionCon
         // Create continuation dependent on the completion of the returned Future
         auto futureData = mFutureData;
         std::uint32_t const allocSize = mAllocationSize;
+        bool const ownsAllocation = mOwnsAllocation;
+        TaskPriority const priority = mPriority;
         TaskScheduler& owner = mOwner;
+        CancellationToken cancellation;
+        cancellation.Swap(mCancellation);
 
         // Get value from result
-        auto contFunc = [=] () -> ResultType { return result.Get(); };
-        typedef ScheduledTask<decltype(contFunc)> ContTaskType;
+        typedef FutureValueFunctor<ResultType> ContFuncType;
+        typedef ScheduledTask<ContFuncType> ContTaskType;
+        ContFuncType contFunc(result);
 
         ContTaskType* contTask;
         // TODO: statically guarantee sufficient space for continuation in any task returning a Future<T>
-        if (sizeof(ScheduledTask<F>) >= sizeof(ContTaskType) || allocSize >= sizeof(ContTaskType))
+        if (allocSize >= sizeof(ContTaskType))
         {
             // Reuse current allocation
             this->~ScheduledTask<F>();
-            contTask = new (this) ContTaskType(owner, std::move(contFunc), futureData, 1, allocSize);
+            contTask = new (this) ContTaskType(owner, std::move(contFunc), futureData, 1, allocSize, ownsAllocation);
         }
         else
         {
             // Create new allocation
-            delete this;
-            contTask = new ContTaskType(owner, std::move(contFunc), futureData, 1);
+            Destroy();
+            std::uint32_t contAllocSize = sizeof(ContTaskType);
+            void* const allocation = Allocate(owner, contAllocSize);
+            contTask = new (allocation) ContTaskType(owner, std::move(contFunc), futureData, 1, contAllocSize, true);
         }
 
+        contTask->mPriority = priority;
+        contTask->mCancellation.Swap(cancellation);
+
         if (!result.AddWaiter([=] { contTask->NotifyDependencyReady(); }))
             contTask->NotifyDependencyReady();
 
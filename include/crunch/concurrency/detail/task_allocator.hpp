@@ -0,0 +1,161 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_TASK_ALLOCATOR_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_TASK_ALLOCATOR_HPP
+
+#include "crunch/base/align.hpp"
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/tasks_api.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Size class slab allocator for task memory.
+// Each allocator is owned by a single thread at a time, which allocates and frees without synchronization.
+// Blocks freed by other threads are pushed onto a per size class remote free list in the owning allocator,
+// which the owner reclaims in bulk when its local free list runs dry.
+// Slabs are aligned to their size, so the owning allocator of a block is found by masking its address.
+// Requests larger than the largest size class go to the global heap.
+// Blocks may outlive their allocator, e.g., futures outliving the scheduler. On destruction, slabs with blocks still in
+// use are orphaned rather than freed, and the last of their blocks to be freed releases the slab. Freeing must then
+// happen after the destruction, not concurrently with it.
+class TaskAllocator : NonCopyable
+{
+public:
+    static std::uint32_t const MinLogBlockSize = 6;
+    static std::uint32_t const SizeClassCount = 4;
+    static std::uint32_t const MaxBlockSize = 1u << (MinLogBlockSize + SizeClassCount - 1);
+    static std::size_t const SlabSize = 64 * 1024;
+
+    CRUNCH_CONCURRENCY_TASKS_API TaskAllocator();
+    CRUNCH_CONCURRENCY_TASKS_API ~TaskAllocator();
+
+    // Size of the block that will be returned by Allocate() for a request of requiredSize bytes
+    static std::uint32_t GetAllocationSize(std::uint32_t requiredSize)
+    {
+        if (requiredSize > MaxBlockSize)
+            return requiredSize;
+
+        return GetBlockSize(GetSizeClass(requiredSize));
+    }
+
+    // Owner thread only. allocationSize must be a value returned by GetAllocationSize()
+    void* Allocate(std::uint32_t allocationSize)
+    {
+        if (allocationSize > MaxBlockSize)
+            return ::operator new(allocationSize);
+
+        std::uint32_t const sizeClass = GetSizeClass(allocationSize);
+        Block* block = mFreeLists[sizeClass];
+        if (block == nullptr)
+        {
+            RemoteFreeList& remote = mRemoteFreeLists[sizeClass];
+            if (remote.head.Load(MEMORY_ORDER_RELAXED) == nullptr)
+                return AllocateFromSlab(sizeClass);
+
+            block = remote.head.Swap(nullptr, MEMORY_ORDER_ACQUIRE);
+        }
+
+        mFreeLists[sizeClass] = block->next;
+        return block;
+    }
+
+    // Any thread. caller is the allocator owned by the calling thread, or nullptr if it owns none
+    static void Free(void* allocation, std::uint32_t allocationSize, TaskAllocator* caller)
+    {
+        if (allocationSize > MaxBlockSize)
+        {
+            ::operator delete(allocation);
+            return;
+        }
+
+        Slab* const slab = Slab::FromBlock(allocation);
+        TaskAllocator* const owner = slab->owner;
+        Block* const block = static_cast<Block*>(allocation);
+
+        if (owner == nullptr)
+        {
+            FreeOrphaned(slab);
+            return;
+        }
+
+        if (owner == caller)
+        {
+            block->next = owner->mFreeLists[slab->sizeClass];
+            owner->mFreeLists[slab->sizeClass] = block;
+        }
+        else
+        {
+            Atomic<Block*>& head = owner->mRemoteFreeLists[slab->sizeClass].head;
+            Block* next = head.Load(MEMORY_ORDER_RELAXED);
+            for (;;)
+            {
+                block->next = next;
+                if (head.CompareAndSwap(next, block))
+                    break;
+
+                next = head.Load(MEMORY_ORDER_RELAXED);
+            }
+        }
+    }
+
+private:
+    struct Block
+    {
+        Block* next;
+    };
+
+    struct Slab
+    {
+        static Slab* FromBlock(void* block)
+        {
+            return reinterpret_cast<Slab*>(reinterpret_cast<std::uintptr_t>(block) & ~(static_cast<std::uintptr_t>(SlabSize) - 1));
+        }
+
+        TaskAllocator* owner;           // Null once orphaned
+        std::uint32_t sizeClass;
+        Slab* next;
+        Atomic<std::uint32_t> liveCount; // Blocks in use. Only maintained once orphaned
+    };
+
+    // Keep remote lists on separate cache lines from each other and from owner local state
+    struct CRUNCH_ALIGN_PREFIX(128) RemoteFreeList
+    {
+        RemoteFreeList() : head(nullptr) {}
+
+        Atomic<Block*> head;
+    } CRUNCH_ALIGN_POSTFIX(128);
+
+    static std::uint32_t GetSizeClass(std::uint32_t size)
+    {
+        std::uint32_t sizeClass = 0;
+        while (GetBlockSize(sizeClass) < size)
+            sizeClass++;
+        return sizeClass;
+    }
+
+    static std::uint32_t GetBlockSize(std::uint32_t sizeClass)
+    {
+        return 1u << (MinLogBlockSize + sizeClass);
+    }
+
+    CRUNCH_CONCURRENCY_TASKS_API void* AllocateFromSlab(std::uint32_t sizeClass);
+    CRUNCH_CONCURRENCY_TASKS_API static void FreeOrphaned(Slab* slab);
+
+    // Owner local state
+    Block* mFreeLists[SizeClassCount];
+    char* mSlabBegin[SizeClassCount];
+    char* mSlabEnd[SizeClassCount];
+    Slab* mSlabs;
+
+    RemoteFreeList mRemoteFreeLists[SizeClassCount];
+};
+
+}}}
+
+#endif
@@ -0,0 +1,144 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_TASK_FUTURE_DATA_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_TASK_FUTURE_DATA_HPP
+
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/future.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+template<typename F>
+class ScheduledTask;
+
+struct FusedTaskHeader
+{
+    std::uint32_t allocationSize;
+};
+
+// Future data co-allocated with the task producing its value.
+// The block is laid out as [FusedTaskHeader][TaskFutureData<T>][ScheduledTask<F>].
+// The task holds a reference to the future data until it completes, so the future data reference count
+// acts as the reference count for the whole block, which is freed when the last reference is released.
+template<typename T>
+class TaskFutureData : public FutureData<T>
+{
+public:
+    // Offset of future data from the start of the block
+    static std::size_t GetOffset()
+    {
+        std::size_t const alignment = std::alignment_of<TaskFutureData<T>>::value;
+        return (sizeof(FusedTaskHeader) + alignment - 1) / alignment * alignment;
+    }
+
+    static TaskFutureData* Create(void* allocation, std::uint32_t allocationSize, std::uint32_t refCount)
+    {
+        new (allocation) FusedTaskHeader();
+        static_cast<FusedTaskHeader*>(allocation)->allocationSize = allocationSize;
+        return new (static_cast<char*>(allocation) + GetOffset()) TaskFutureData(refCount);
+    }
+
+    // Invoked through the virtual destructor when the last reference is released. Returns the whole block to the task allocator
+    static void operator delete(void* p);
+
+    // Complete without running the task. The value is default constructed if possible, and must not be read otherwise
+    void SetCancelled()
+    {
+        // Published to readers of the future by making it ready
+        mCancelled.Store(1, MEMORY_ORDER_RELAXED);
+        SetCancelledValue(typename std::is_default_constructible<T>::type());
+    }
+
+    bool IsCancelled() const
+    {
+        return mCancelled.Load(MEMORY_ORDER_ACQUIRE) != 0;
+    }
+
+private:
+    explicit TaskFutureData(std::uint32_t refCount)
+        : FutureData<T>(refCount)
+        , mCancelled(0)
+    {}
+
+    void SetCancelledValue(std::true_type)
+    {
+        this->Set(T());
+    }
+
+    void SetCancelledValue(std::false_type)
+    {
+        this->SetReady();
+    }
+
+    Atomic<std::uint32_t> mCancelled;
+};
+
+// Value of future, moved out if future holds the only reference to its data
+template<typename T>
+T TakeFutureValue(Future<T>& future)
+{
+    T const& value = future.Get();
+    if (future.GetData()->GetRefCount() != 1)
+        return value;
+
+    // GetRefCount() is a plain load. Acquire, so reads of the value by holders that have since released their
+    // reference happen before it is moved from
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Stored in mutable state shared by nothing else
+    return std::move(const_cast<T&>(value));
+}
+
+inline void TakeFutureValue(Future<void>& future)
+{
+    future.Get();
+}
+
+// Continuation of a task returning a future, completing with its value. Unless the task kept another reference to
+// the returned future, the continuation holds the only one and the value is moved rather than copied
+template<typename T>
+class FutureValueFunctor
+{
+public:
+    explicit FutureValueFunctor(Future<T> future)
+        : mFuture(std::move(future))
+    {}
+
+    T operator () ()
+    {
+        return TakeFutureValue(mFuture);
+    }
+
+private:
+    Future<T> mFuture;
+};
+
+template<typename T, typename F>
+struct FusedTaskLayout
+{
+    typedef TaskFutureData<T> FutureDataType;
+    typedef ScheduledTask<F> TaskType;
+
+    static std::size_t GetTaskOffset()
+    {
+        std::size_t const alignment = std::alignment_of<TaskType>::value;
+        return (FutureDataType::GetOffset() + sizeof(FutureDataType) + alignment - 1) / alignment * alignment;
+    }
+
+    static std::size_t GetSize()
+    {
+        return GetTaskOffset() + sizeof(TaskType);
+    }
+};
+
+}}}
+
+#endif
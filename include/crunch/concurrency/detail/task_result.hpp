@@ -6,6 +6,19 @@
 
 #include "crunch/base/result_of.hpp"
 #include "crunch/concurrency/future.hpp"
+#include "crunch/concurrency/tasks_api.hpp"
+
+#include <type_traits>
+#include <utility>
+
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+namespace Crunch { namespace Concurrency {
+
+template<typename T>
+class Coroutine;
+
+}}
+#endif
 
 namespace Crunch { namespace Concurrency { namespace Detail {
 
@@ -41,8 +54,17 @@ struct StripFuture<Future<T>>
     typedef T Type;
 };
 
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+template<typename T>
+struct StripFuture<Coroutine<T>>
+{
+    typedef T Type;
+};
+#endif
+
+// F may be a reference, as deduced for forwarded functors. Both const and mutable call operators are recognised
 template<typename F>
-struct ReturnOfTask : ReturnOfTask<decltype(&F::operator())>
+struct ReturnOfTask : ReturnOfTask<decltype(&std::remove_reference<F>::type::operator())>
 {};
 
 template<typename ClassType, typename ReturnType>
@@ -51,12 +73,24 @@ struct ReturnOfTask<ReturnType (ClassType::*)() const>
     typedef ReturnType Type;
 };
 
+template<typename ClassType, typename ReturnType>
+struct ReturnOfTask<ReturnType (ClassType::*)()>
+{
+    typedef ReturnType Type;
+};
+
 template<typename ClassType, typename ReturnType, typename A0>
 struct ReturnOfTask<ReturnType (ClassType::*)(A0) const>
 {
     typedef ReturnType Type;
 };
 
+template<typename ClassType, typename ReturnType, typename A0>
+struct ReturnOfTask<ReturnType (ClassType::*)(A0)>
+{
+    typedef ReturnType Type;
+};
+
 template<typename F>
 struct ResultOfTask
 {
@@ -67,6 +101,7 @@ struct ResultOfTask
 struct TaskResultClassVoid {};
 struct TaskResultClassGeneric {};
 struct TaskResultClassFuture {};
+struct TaskResultClassCoroutine {};
 
 template<typename ResultType, typename ReturnType>
 struct TaskResultClass
@@ -86,12 +121,20 @@ struct TaskResultClass<R, Future<R>>
     typedef TaskResultClassFuture Type;
 };
 
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+template<typename R>
+struct TaskResultClass<R, Coroutine<R>>
+{
+    typedef TaskResultClassCoroutine Type;
+};
+#endif
+
 struct TaskCallClassVoid {};
 struct TaskCallClassExecutionContext {};
 
 
 template<typename F>
-struct TaskCallClass : TaskCallClass<decltype(&F::operator())>
+struct TaskCallClass : TaskCallClass<decltype(&std::remove_reference<F>::type::operator())>
 {};
 
 template<typename ClassType, typename ReturnType>
@@ -100,12 +143,90 @@ struct TaskCallClass<ReturnType (ClassType::*)() const>
     typedef TaskCallClassVoid Type;
 };
 
+template<typename ClassType, typename ReturnType>
+struct TaskCallClass<ReturnType (ClassType::*)()>
+{
+    typedef TaskCallClassVoid Type;
+};
+
 template<typename ClassType, typename ReturnType, typename A0>
 struct TaskCallClass<ReturnType (ClassType::*)(A0) const>
 {
     typedef TaskCallClassExecutionContext Type;
 };
 
+template<typename ClassType, typename ReturnType, typename A0>
+struct TaskCallClass<ReturnType (ClassType::*)(A0)>
+{
+    typedef TaskCallClassExecutionContext Type;
+};
+
+
+// Functor of a task assigning the result of F to a destination owned by the caller, rather than completing its future with it
+template<typename T, typename F>
+class ResultPlacementFunctor
+{
+public:
+    template<typename G>
+    ResultPlacementFunctor(T& destination, G&& f)
+        : mDestination(&destination)
+        , mFunctor(std::forward<G>(f))
+    {}
+
+    void operator () ()
+    {
+        *mDestination = mFunctor();
+    }
+
+private:
+    T* mDestination;
+    F mFunctor;
+};
+
+// Functor of a task letting F fill a destination owned by the caller in place
+template<typename T, typename F>
+class FillPlacementFunctor
+{
+public:
+    template<typename G>
+    FillPlacementFunctor(T& destination, G&& f)
+        : mDestination(&destination)
+        , mFunctor(std::forward<G>(f))
+    {}
+
+    void operator () ()
+    {
+        mFunctor(*mDestination);
+    }
+
+private:
+    T* mDestination;
+    F mFunctor;
+};
+
+// True if F takes a T& to fill, rather than returning its result
+template<typename F, typename T>
+class IsFillFunctor
+{
+    template<typename G, typename U>
+    static auto Test(int) -> decltype(std::declval<G&>()(std::declval<U&>()), std::true_type());
+
+    template<typename G, typename U>
+    static std::false_type Test(...);
+
+public:
+    typedef decltype(Test<F, T>(0)) Type;
+    static bool const value = Type::value;
+};
+
+template<typename T, typename F>
+struct PlacementFunctor
+{
+    typedef typename std::conditional<
+        IsFillFunctor<F, T>::value,
+        FillPlacementFunctor<T, F>,
+        ResultPlacementFunctor<T, F>>::type Type;
+};
 
 template<typename F>
 struct TaskTraits
@@ -0,0 +1,115 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_TRACE_RING_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_TRACE_RING_HPP
+
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/tasks_api.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+// Define as 0 to compile out all scheduler tracing.
+// When compiled in, tracing is enabled at runtime with TaskScheduler::Config::traceCapacity
+#if !defined (CRUNCH_CONCURRENCY_TASKS_TRACING)
+#   define CRUNCH_CONCURRENCY_TASKS_TRACING 1
+#endif
+
+#if CRUNCH_CONCURRENCY_TASKS_TRACING
+#   define CRUNCH_CONCURRENCY_TASKS_TRACE(ring, type, argument) do { if (ring) (ring)->Record(type, argument); } while (0)
+#else
+#   define CRUNCH_CONCURRENCY_TASKS_TRACE(ring, type, argument) do {} while (0)
+#endif
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+enum TraceEventType
+{
+    TRACE_EVENT_SPAWN,
+    TRACE_EVENT_DISPATCH_BEGIN,
+    TRACE_EVENT_DISPATCH_END,
+    TRACE_EVENT_STEAL_ATTEMPT,
+    TRACE_EVENT_STEAL_SUCCESS,
+    TRACE_EVENT_PARK,
+    TRACE_EVENT_UNPARK
+};
+
+struct TraceEvent
+{
+    std::uint64_t timestamp; // Nanoseconds, monotonic
+    std::uint64_t argument;  // Event specific, typically a task address
+    TraceEventType type;
+};
+
+// Fixed size ring of timestamped events, written by a single thread and overwriting the oldest events when full.
+// Can be read from any thread while being written. Events overwritten during the read are discarded.
+class TraceRing : NonCopyable
+{
+public:
+    // Capacity is rounded up to a power of 2
+    explicit TraceRing(std::uint32_t id, std::uint32_t capacity)
+        : mId(id)
+        , mMask(RoundUpToPowerOf2(capacity) - 1)
+        , mSlots(new Slot[mMask + 1])
+        , mHead(0)
+    {}
+
+    std::uint32_t GetId() const { return mId; }
+
+    void Record(TraceEventType type, std::uint64_t argument)
+    {
+        // Order the previous head update before overwriting a slot, so readers can detect overwrites. Free on x86
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::uint64_t const head = mHead.Load(MEMORY_ORDER_RELAXED);
+        Slot& slot = mSlots[head & mMask];
+        slot.timestamp.Store(GetTimestamp(), MEMORY_ORDER_RELAXED);
+        slot.argument.Store(argument, MEMORY_ORDER_RELAXED);
+        slot.type.Store(static_cast<std::uint32_t>(type), MEMORY_ORDER_RELAXED);
+        mHead.Store(head + 1, MEMORY_ORDER_RELEASE);
+    }
+
+    // Append events currently in the ring, oldest first
+    CRUNCH_CONCURRENCY_TASKS_API void CopyEvents(std::vector<TraceEvent>& events) const;
+
+    static std::uint64_t GetTimestamp()
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+private:
+    struct Slot
+    {
+        Atomic<std::uint64_t> timestamp;
+        Atomic<std::uint64_t> argument;
+        Atomic<std::uint32_t> type;
+    };
+
+    static std::uint32_t RoundUpToPowerOf2(std::uint32_t value)
+    {
+        std::uint32_t result = 1;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+
+    std::uint32_t const mId;
+    std::uint64_t const mMask;
+    std::unique_ptr<Slot[]> mSlots;
+    Atomic<std::uint64_t> mHead; // Total number of events recorded
+};
+
+// Write events in the Chrome trace event JSON format, as loaded by chrome://tracing and Perfetto.
+// Each ring is shown as a separate thread.
+CRUNCH_CONCURRENCY_TASKS_API void WriteChromeTrace(std::ostream& stream, std::vector<TraceRing const*> const& rings);
+
+}}}
+
+#endif
@@ -0,0 +1,103 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_WHEN_ALL_NODE_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_WHEN_ALL_NODE_HPP
+
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/cancellation_token.hpp"
+#include "crunch/concurrency/waitable.hpp"
+#include "crunch/concurrency/detail/task_future_data.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Futures are handles to shared state, so waiting on a const future is harmless
+inline IWaitable& GetWaitable(IWaitable const& waitable) { return const_cast<IWaitable&>(waitable); }
+inline IWaitable& GetWaitable(IWaitable const* waitable) { return const_cast<IWaitable&>(*waitable); }
+
+// Counter completing a future once a number of waitables are ready, without running a task.
+// Co-allocated with the future data as [FusedTaskHeader][TaskFutureData<void>][WhenAllNode][JoinWaiter x count],
+// with an intrusive waiter per waitable, so joining costs a single allocation and one atomic decrement per waitable.
+// The node holds a reference to the future data until completion, and is freed along with it.
+class WhenAllNode : NonCopyable
+{
+public:
+    typedef TaskFutureData<void> FutureDataType;
+
+    struct JoinWaiter : Waiter
+    {
+        explicit JoinWaiter(WhenAllNode* node)
+            : Waiter(&Notify)
+            , node(node)
+        {}
+
+        static void Notify(Waiter* waiter)
+        {
+            static_cast<JoinWaiter*>(waiter)->node->Arrive(1);
+        }
+
+        WhenAllNode* node;
+    };
+
+    // Arrive(1) must be called count + 1 times in total, the last by the creator after registering all waiters
+    WhenAllNode(FutureDataType* futureData, std::uint32_t count, CancellationToken const& cancellation)
+        : mFutureData(futureData)
+        , mPendingCount(count + 1)
+        , mCancellation(cancellation)
+    {}
+
+    // Offset of the node from the start of the block
+    static std::size_t GetOffset()
+    {
+        std::size_t const alignment = std::alignment_of<WhenAllNode>::value;
+        return (FutureDataType::GetOffset() + sizeof(FutureDataType) + alignment - 1) / alignment * alignment;
+    }
+
+    static std::size_t GetSize(std::uint32_t count)
+    {
+        return GetOffset() + sizeof(WhenAllNode) + count * sizeof(JoinWaiter);
+    }
+
+    JoinWaiter* GetWaiters()
+    {
+        return reinterpret_cast<JoinWaiter*>(this + 1);
+    }
+
+    // Owe count more arrivals. Only valid while an arrival is still owed to the caller, so the count can not reach zero meanwhile
+    void Expect(std::uint32_t count)
+    {
+        mPendingCount.Add(count, MEMORY_ORDER_RELAXED);
+    }
+
+    void Arrive(std::uint32_t count)
+    {
+        if (mPendingCount.Sub(count) != count)
+            return;
+
+        // Last arrival. Nothing else references the node, which may be freed by releasing the future data
+        FutureDataType* const futureData = mFutureData;
+        if (mCancellation.IsCancelled())
+            futureData->SetCancelled();
+        else
+            futureData->Set();
+
+        this->~WhenAllNode();
+        Release(futureData);
+    }
+
+private:
+    FutureDataType* mFutureData;
+    Atomic<std::uint32_t> mPendingCount;
+    CancellationToken mCancellation;
+};
+
+static_assert(sizeof(WhenAllNode) % std::alignment_of<WhenAllNode::JoinWaiter>::value == 0, "Waiters must be aligned when following the node");
+
+}}}
+
+#endif
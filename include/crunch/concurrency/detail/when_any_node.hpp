@@ -0,0 +1,168 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_WHEN_ANY_NODE_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_WHEN_ANY_NODE_HPP
+
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/cancellation_token.hpp"
+#include "crunch/concurrency/waitable.hpp"
+#include "crunch/concurrency/detail/task_future_data.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// True if the task producing the future data was skipped due to cancellation
+typedef bool (*CancelledCheck)(void const* futureData);
+
+template<typename T>
+bool IsFutureDataCancelled(void const* futureData)
+{
+    return static_cast<TaskFutureData<T> const*>(futureData)->IsCancelled();
+}
+
+// Input of WhenAny. Futures returned by the scheduler can be checked for cancellation once ready, other waitables can not
+struct WhenAnyInput
+{
+    IWaitable* waitable;
+    void const* futureData;
+    CancelledCheck isCancelled; // Null if the input can not be cancelled
+};
+
+inline WhenAnyInput MakeWhenAnyInput(IWaitable const& waitable)
+{
+    WhenAnyInput const input = { &const_cast<IWaitable&>(waitable), nullptr, nullptr };
+    return input;
+}
+
+inline WhenAnyInput MakeWhenAnyInput(IWaitable const* waitable)
+{
+    return MakeWhenAnyInput(*waitable);
+}
+
+template<typename T>
+WhenAnyInput MakeWhenAnyInput(Future<T> const& future)
+{
+    WhenAnyInput const input = { &const_cast<Future<T>&>(future), future.GetData(), &IsFutureDataCancelled<T> };
+    return input;
+}
+
+template<typename T>
+WhenAnyInput MakeWhenAnyInput(Future<T> const* future)
+{
+    return MakeWhenAnyInput(*future);
+}
+
+inline WhenAnyInput MakeWhenAnyInput(WhenAnyInput const& input)
+{
+    return input;
+}
+
+// Completes a future with the index of the first of a number of waitables to become ready, without running a task.
+// Laid out like WhenAllNode, as [FusedTaskHeader][TaskFutureData<std::uint32_t>][WhenAnyNode][AnyWaiter x count].
+// The first arrival of an input that was not cancelled claims the result and cancels the losers' token, if any. If all
+// inputs were cancelled, the last arrival completes the future cancelled. The node stays alive until the remaining
+// waiters have fired, as they can not be safely unregistered while other threads may be notifying them.
+class WhenAnyNode : NonCopyable
+{
+public:
+    typedef TaskFutureData<std::uint32_t> FutureDataType;
+
+    static std::uint32_t const NoIndex = ~std::uint32_t(0);
+
+    struct AnyWaiter : Waiter
+    {
+        AnyWaiter(WhenAnyNode* node, std::uint32_t index, WhenAnyInput const& input)
+            : Waiter(&Notify)
+            , node(node)
+            , index(index)
+            , futureData(input.futureData)
+            , isCancelled(input.isCancelled)
+        {}
+
+        // Index to arrive with once the input is ready, or NoIndex if it was cancelled and can not win
+        std::uint32_t GetReadyIndex() const
+        {
+            return isCancelled != nullptr && isCancelled(futureData) ? NoIndex : index;
+        }
+
+        // The input is being made ready, so its future data is still alive
+        static void Notify(Waiter* waiter)
+        {
+            AnyWaiter* const self = static_cast<AnyWaiter*>(waiter);
+            self->node->Arrive(self->GetReadyIndex(), 1);
+        }
+
+        WhenAnyNode* node;
+        std::uint32_t index;
+        void const* futureData;
+        CancelledCheck isCancelled;
+    };
+
+    // Arrivals must total count + 1, the last by the creator after registering waiters
+    WhenAnyNode(FutureDataType* futureData, std::uint32_t count, CancellationToken const& losers)
+        : mFutureData(futureData)
+        , mPendingCount(count + 1)
+        , mClaimed(0)
+        , mLosers(losers)
+    {}
+
+    static std::size_t GetOffset()
+    {
+        std::size_t const alignment = std::alignment_of<WhenAnyNode>::value;
+        return (FutureDataType::GetOffset() + sizeof(FutureDataType) + alignment - 1) / alignment * alignment;
+    }
+
+    static std::size_t GetSize(std::uint32_t count)
+    {
+        return GetOffset() + sizeof(WhenAnyNode) + count * sizeof(AnyWaiter);
+    }
+
+    AnyWaiter* GetWaiters()
+    {
+        return reinterpret_cast<AnyWaiter*>(this + 1);
+    }
+
+    bool IsClaimed() const
+    {
+        return mClaimed.Load(MEMORY_ORDER_RELAXED) != 0;
+    }
+
+    // Account for count arrivals. index is the ready waitable, or NoIndex for arrivals not making one ready or cancelled
+    void Arrive(std::uint32_t index, std::uint32_t count)
+    {
+        if (index != NoIndex && mClaimed.Load(MEMORY_ORDER_RELAXED) == 0 && mClaimed.Swap(1) == 0)
+        {
+            // Stop the losers before completing, so work resumed by the result does not compete with them
+            mLosers.Cancel();
+            mFutureData->Set(index);
+        }
+
+        if (mPendingCount.Sub(count) != count)
+            return;
+
+        // No winner
+        FutureDataType* const futureData = mFutureData;
+        if (mClaimed.Load(MEMORY_ORDER_RELAXED) == 0)
+            futureData->SetCancelled();
+
+        this->~WhenAnyNode();
+        Release(futureData);
+    }
+
+private:
+    FutureDataType* mFutureData;
+    Atomic<std::uint32_t> mPendingCount;
+    Atomic<std::uint32_t> mClaimed;
+    CancellationToken mLosers;
+};
+
+static_assert(sizeof(WhenAnyNode) % std::alignment_of<WhenAnyNode::AnyWaiter>::value == 0, "Waiters must be aligned when following the node");
+
+}}}
+
+#endif
@@ -0,0 +1,39 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_DETAIL_XOR_SHIFT_RANDOM_HPP
+#define CRUNCH_CONCURRENCY_DETAIL_XOR_SHIFT_RANDOM_HPP
+
+#include <cstdint>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Marsaglia xorshift generator. Cheap, unsynchronized source of randomness for per thread decisions like victim selection
+class XorShiftRandom
+{
+public:
+    explicit XorShiftRandom(std::uint32_t seed)
+        : mState(seed != 0 ? seed : 0x9e3779b9)
+    {}
+
+    std::uint32_t Next()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+    // Random number in [0, bound)
+    std::uint32_t Next(std::uint32_t bound)
+    {
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>(Next()) * bound) >> 32);
+    }
+
+private:
+    std::uint32_t mState;
+};
+
+}}}
+
+#endif
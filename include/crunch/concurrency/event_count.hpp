@@ -0,0 +1,102 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_EVENT_COUNT_HPP
+#define CRUNCH_CONCURRENCY_EVENT_COUNT_HPP
+
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/base/platform.hpp"
+#include "crunch/concurrency/tasks_api.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+#if !defined (CRUNCH_PLATFORM_LINUX) && !defined (CRUNCH_PLATFORM_WIN32)
+#   include <condition_variable>
+#   include <mutex>
+#endif
+
+namespace Crunch { namespace Concurrency {
+
+// Lets threads block until a condition, checked outside of any lock, might have changed.
+// Waiters announce themselves with PrepareWait(), re-check their condition, and then either Wait() or CancelWait().
+// Notifiers change the condition and then call Notify*(), which costs a fence and a load when nobody is waiting.
+//
+//   Waiter:                             Notifier:
+//   key = ec.PrepareWait();             MakeConditionTrue();
+//   if (Condition()) ec.CancelWait();   ec.NotifyOne();
+//   else ec.Wait(key);
+//
+// Blocks on a futex on Linux and WaitOnAddress() on Windows.
+class EventCount : NonCopyable
+{
+public:
+    typedef std::uint32_t Key;
+
+    EventCount()
+        : mEpoch(0)
+        , mWaiterCount(0)
+    {}
+
+    Key PrepareWait()
+    {
+        // Sequentially consistent to order registration before the caller's condition check
+        mWaiterCount.fetch_add(1, std::memory_order_seq_cst);
+        return mEpoch.load(std::memory_order_seq_cst);
+    }
+
+    void CancelWait()
+    {
+        mWaiterCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Block until notified after PrepareWait() returned key. May return spuriously
+    void Wait(Key key)
+    {
+        while (mEpoch.load(std::memory_order_acquire) == key)
+            WaitForEpochChange(key);
+
+        mWaiterCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void NotifyOne()
+    {
+        if (HasWaiters())
+            Notify(false);
+    }
+
+    void NotifyAll()
+    {
+        if (HasWaiters())
+            Notify(true);
+    }
+
+    // Number of threads between PrepareWait() and returning from Wait() or CancelWait()
+    std::uint32_t GetWaiterCount() const
+    {
+        return mWaiterCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    bool HasWaiters() const
+    {
+        // Order the caller's preceding condition change before reading the waiter count. Pairs with PrepareWait()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return mWaiterCount.load(std::memory_order_relaxed) != 0;
+    }
+
+    CRUNCH_CONCURRENCY_TASKS_API void Notify(bool all);
+    CRUNCH_CONCURRENCY_TASKS_API void WaitForEpochChange(Key key);
+
+    std::atomic<std::uint32_t> mEpoch;
+    std::atomic<std::uint32_t> mWaiterCount;
+
+#if !defined (CRUNCH_PLATFORM_LINUX) && !defined (CRUNCH_PLATFORM_WIN32)
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+#endif
+};
+
+}}
+
+#endif
@@ -4,6 +4,8 @@
 #ifndef CRUNCH_CONCURRENCY_INDEX_RANGE_HPP
 #define CRUNCH_CONCURRENCY_INDEX_RANGE_HPP
 
+#include <algorithm>
+#include <cstddef>
 #include <utility>
 
 namespace Crunch { namespace Concurrency {
@@ -31,6 +33,18 @@ public:
         return std::make_pair(ThisType(mBegin, half, mGrainSize), ThisType(half, mEnd, mGrainSize));
     }
 
+    // Split in proportion, with lowerShare / (lowerShare + upperShare) of the range in the lower part. Both parts are
+    // kept at or above the grain size if the range is at least twice the grain size, and it is halved otherwise
+    std::pair<ThisType, ThisType> Split(std::size_t lowerShare, std::size_t upperShare) const
+    {
+        std::size_t const size = Size();
+        std::size_t const lowerSize = size < 2 * mGrainSize
+            ? size / 2
+            : std::min(std::max(size * lowerShare / (lowerShare + upperShare), mGrainSize), size - mGrainSize);
+        IndexType const split = mBegin + static_cast<IndexType>(lowerSize);
+        return std::make_pair(ThisType(mBegin, split, mGrainSize), ThisType(split, mEnd, mGrainSize));
+    }
+
     std::size_t Size() const
     {
         return static_cast<std::size_t>(mEnd - mBegin);
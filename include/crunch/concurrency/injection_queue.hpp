@@ -0,0 +1,59 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_INJECTION_QUEUE_HPP
+#define CRUNCH_CONCURRENCY_INJECTION_QUEUE_HPP
+
+#include "crunch/base/noncopyable.hpp"
+#include "crunch/concurrency/atomic.hpp"
+
+namespace Crunch { namespace Concurrency {
+
+// Intrusive multi-producer multi-consumer queue for injecting work into a pool of consumers from arbitrary threads.
+// Producers push with a single CAS. Consumers detach all pending elements with a single swap and process them as a batch.
+// Detaching the whole list avoids the ABA hazards of popping individual elements from a lock-free list.
+//
+// T must provide SetNext(T&, T*) and GetNext(T&) free functions for linking, as with MPMCLifoList.
+template<typename T>
+class InjectionQueue : NonCopyable
+{
+public:
+    InjectionQueue()
+        : mHead(nullptr)
+    {}
+
+    void Push(T* value)
+    {
+        T* head = mHead.Load(MEMORY_ORDER_RELAXED);
+        for (;;)
+        {
+            SetNext(*value, head);
+            if (mHead.CompareAndSwap(head, value))
+                return;
+
+            head = mHead.Load(MEMORY_ORDER_RELAXED);
+        }
+    }
+
+    bool IsEmpty() const
+    {
+        return mHead.Load(MEMORY_ORDER_RELAXED) == nullptr;
+    }
+
+    // Detach all elements pushed so far. Returns a list linked through GetNext, most recently pushed element first.
+    T* PopAll()
+    {
+        // Avoid taking the cache line exclusive when there's nothing to take
+        if (IsEmpty())
+            return nullptr;
+
+        return mHead.Swap(nullptr, MEMORY_ORDER_ACQUIRE);
+    }
+
+private:
+    Atomic<T*> mHead;
+};
+
+}}
+
+#endif
@@ -4,39 +4,265 @@
 #ifndef CRUNCH_CONCURRENCY_PARALLEL_FOR_HPP
 #define CRUNCH_CONCURRENCY_PARALLEL_FOR_HPP
 
+#include "crunch/concurrency/partitioner.hpp"
 #include "crunch/concurrency/range.hpp"
 #include "crunch/concurrency/task_scheduler.hpp"
-#include "crunch/containers/small_vector.hpp"
 
 #include <algorithm>
+#include <cstddef>
+#include <utility>
 
 namespace Crunch { namespace Concurrency {
 
-// TODO: Check if current task was stolen and reduce split depth if not
+namespace Detail
+{
+    // Share of the pending count of a ParallelFor invocation, arriving at its join when destroyed. Every task of the
+    // invocation holds one, so a single counter tracks the whole spawn tree, and a cancelled task still arrives as its
+    // functor is destroyed without running
+    class ParallelForJoin
+    {
+    public:
+        explicit ParallelForJoin(WhenAllNode* node)
+            : mNode(node)
+        {}
+
+        ParallelForJoin(ParallelForJoin&& rhs)
+            : mNode(rhs.mNode)
+        {
+            rhs.mNode = nullptr;
+        }
+
+        ~ParallelForJoin()
+        {
+            if (mNode != nullptr)
+                mNode->Arrive(1);
+        }
+
+        // Share for a task about to be added
+        ParallelForJoin Fork() const
+        {
+            mNode->Expect(1);
+            return ParallelForJoin(mNode);
+        }
+
+    private:
+        ParallelForJoin(ParallelForJoin const&);
+        ParallelForJoin& operator = (ParallelForJoin const&);
+
+        WhenAllNode* mNode;
+    };
+
+    // Task running g with its share of the join
+    template<typename G>
+    class ParallelForTask
+    {
+    public:
+        ParallelForTask(G&& g, ParallelForJoin&& join)
+            : mJoin(std::move(join))
+            , mFunctor(std::move(g))
+        {}
+
+        ParallelForTask(ParallelForTask&& rhs)
+            : mJoin(std::move(rhs.mJoin))
+            , mFunctor(std::move(rhs.mFunctor))
+        {}
+
+        void operator () ()
+        {
+            mFunctor(mJoin);
+        }
+
+    private:
+        // Declared first so it is destroyed last. Releasing the join may complete the caller's future, which must not
+        // happen while this task still holds a copy of the user's functor
+        ParallelForJoin mJoin;
+        G mFunctor;
+    };
+
+    template<typename G>
+    ParallelForTask<G> MakeParallelForTask(G g, ParallelForJoin join)
+    {
+        return ParallelForTask<G>(std::move(g), std::move(join));
+    }
+
+    template<typename R, typename F>
+    void ParallelForSimple(TaskScheduler& s, R const& r, F const& f, CancellationToken const& cancellation, ParallelForJoin const& join)
+    {
+        R rr = r;
+        while (IsRangeSplittable(rr) && !cancellation.IsCancelled())
+        {
+            auto sr = SplitRange(rr);
+            R const upper = sr.second;
+            s.AddDetached(MakeParallelForTask([=, &s] (ParallelForJoin const& taskJoin) {
+                ParallelForSimple(s, upper, f, cancellation, taskJoin);
+            }, join.Fork()), cancellation);
+            rr = sr.first;
+        }
+
+        if (!cancellation.IsCancelled())
+            f(rr);
+    }
+
+    // Lazy binary splitting. The upper half of a splittable range is only split off as a task when the context has no
+    // queued work left for thieves, and is otherwise run right after the lower half. Sub-ranges are still run down to
+    // the grain size, but the task count tracks how often idle contexts actually take work rather than the range size.
+    // Until r is split into splitCount parts, typically one per context, halves are split off regardless, so every
+    // context has a share to take from the start
+    template<typename R, typename F>
+    void ParallelForRange(TaskScheduler& s, R const& r, F const& f, std::size_t splitCount, CancellationToken const& cancellation, ParallelForJoin const& join)
+    {
+        if (cancellation.IsCancelled())
+            return;
+
+        if (!IsRangeSplittable(r))
+        {
+            f(r);
+            return;
+        }
+
+        auto sr = SplitRange(r);
+        if (splitCount > 1 || s.IsLocalQueueEmpty())
+        {
+            std::size_t const upperCount = splitCount / 2;
+            R const upper = sr.second;
+            s.AddDetached(MakeParallelForTask([=, &s] (ParallelForJoin const& taskJoin) {
+                ParallelForRange(s, upper, f, upperCount, cancellation, taskJoin);
+            }, join.Fork()), cancellation);
+            ParallelForRange(s, sr.first, f, splitCount - upperCount, cancellation, join);
+        }
+        else
+        {
+            ParallelForRange(s, sr.first, f, splitCount, cancellation, join);
+            ParallelForRange(s, sr.second, f, splitCount, cancellation, join);
+        }
+    }
+
+    // Split r into blockCount blocks up front, running the lowest and adding the others as tasks
+    template<typename R, typename F>
+    void ParallelForBlocks(TaskScheduler& s, R const& r, F const& f, std::size_t blockCount, CancellationToken const& cancellation, ParallelForJoin const& join)
+    {
+        R rr = r;
+        while (blockCount > 1 && IsRangeSplittable(rr) && !cancellation.IsCancelled())
+        {
+            std::size_t const upperCount = blockCount / 2;
+            blockCount -= upperCount;
+
+            auto sr = SplitRange(rr, blockCount, upperCount);
+            R const upper = sr.second;
+            s.AddDetached(MakeParallelForTask([=, &s] (ParallelForJoin const& taskJoin) {
+                ParallelForBlocks(s, upper, f, upperCount, cancellation, taskJoin);
+            }, join.Fork()), cancellation);
+            rr = sr.first;
+        }
+
+        if (!cancellation.IsCancelled())
+            f(rr);
+    }
+
+    struct ParallelForAffinity
+    {
+        // Blocks are split off the top of the range in order, so the same range and context count always gives the
+        // same blocks. Each is posted to the context recorded for it, and records the context that actually runs it
+        template<typename R, typename F>
+        static void Run(TaskScheduler& s, R const& r, F const& f, AffinityPartitioner& partitioner, CancellationToken const& cancellation, ParallelForJoin const& join)
+        {
+            std::size_t blockCount = std::max<std::size_t>(s.GetContextCount(), 1) * partitioner.mBlocksPerContext;
+            if (partitioner.mContextIds.size() != blockCount)
+                partitioner.mContextIds.assign(blockCount, TaskScheduler::InvalidContextId);
+
+            std::uint32_t* const contextIds = &partitioner.mContextIds[0];
+
+            R rr = r;
+            while (blockCount > 1 && IsRangeSplittable(rr) && !cancellation.IsCancelled())
+            {
+                auto sr = SplitRange(rr, blockCount - 1, 1);
+                blockCount--;
+
+                R const block = sr.second;
+                std::uint32_t* const contextId = contextIds + blockCount;
+                TaskAffinity const affinity = *contextId == TaskScheduler::InvalidContextId
+                    ? TaskAffinity()
+                    : TaskAffinity::ForContext(*contextId);
+                s.AddDetached(MakeParallelForTask([=, &s] (ParallelForJoin const&) {
+                    *contextId = s.GetCurrentContextId();
+                    f(block);
+                }, join.Fork()), TASK_PRIORITY_NORMAL, affinity, cancellation);
+                rr = sr.first;
+            }
+
+            if (!cancellation.IsCancelled())
+            {
+                contextIds[0] = s.GetCurrentContextId();
+                f(rr);
+            }
+        }
+    };
+}
+
+// Run f on sub-ranges covering r, split as decided by the partitioner. Whatever the splitting, all tasks of an
+// invocation complete the returned future through a single shared counter.
+// Stops splitting and skips remaining sub-ranges once cancellation is cancelled. The returned future is then cancelled
 template<typename R, typename F>
-Future<void> ParallelFor(TaskScheduler& s, R const& r, F f)
+Future<void> ParallelFor(TaskScheduler& s, R const& r, F f, SimplePartitioner const&, CancellationToken const& cancellation = CancellationToken())
 {
-    R rr  = r;
-    Containers::SmallVector<Future<void>, 32> children;
-    while (IsRangeSplittable(rr))
-    {
-        auto sr = SplitRange(rr);
-        children.push_back(s.Add([=,&s] {
-            return ParallelFor(s, sr.second, f);
-        }));
-        rr = sr.first;
+    Future<void> result;
+    Detail::ParallelForJoin join(s.CreateJoin(result, cancellation));
+    Detail::ParallelForSimple(s, r, f, cancellation, join);
+    return result;
+}
+
+template<typename R, typename F>
+Future<void> ParallelFor(TaskScheduler& s, R const& r, F f, AutoPartitioner const&, CancellationToken const& cancellation = CancellationToken())
+{
+    Future<void> result;
+    Detail::ParallelForJoin join(s.CreateJoin(result, cancellation));
+
+    // Splitting is driven by the queue of the running context, so start in one
+    std::size_t const splitCount = s.GetContextCount();
+    if (s.GetCurrentContextId() == TaskScheduler::InvalidContextId)
+    {
+        s.AddDetached(Detail::MakeParallelForTask([=, &s] (Detail::ParallelForJoin const& taskJoin) {
+            Detail::ParallelForRange(s, r, f, splitCount, cancellation, taskJoin);
+        }, std::move(join)), cancellation);
+    }
+    else
+    {
+        Detail::ParallelForRange(s, r, f, splitCount, cancellation, join);
     }
 
-    f(rr);
+    return result;
+}
+
+template<typename R, typename F>
+Future<void> ParallelFor(TaskScheduler& s, R const& r, F f, StaticPartitioner const&, CancellationToken const& cancellation = CancellationToken())
+{
+    Future<void> result;
+    Detail::ParallelForJoin join(s.CreateJoin(result, cancellation));
+    Detail::ParallelForBlocks(s, r, f, s.GetContextCount(), cancellation, join);
+    return result;
+}
 
-    Containers::SmallVector<IWaitable*, 32> dep;
-    std::for_each(children.begin(), children.end(), [&](Future<void>& f){
-        dep.push_back(&f);
-    });
+template<typename R, typename F>
+Future<void> ParallelFor(TaskScheduler& s, R const& r, F f, AffinityPartitioner& partitioner, CancellationToken const& cancellation = CancellationToken())
+{
+    Future<void> result;
+    Detail::ParallelForJoin join(s.CreateJoin(result, cancellation));
+    Detail::ParallelForAffinity::Run(s, r, f, partitioner, cancellation, join);
+    return result;
+}
 
-    return s.Add([]{}, &dep[0], static_cast<std::uint32_t>(dep.size()));
+template<typename R, typename F>
+Future<void> ParallelFor(TaskScheduler& s, R const& r, F f, CancellationToken const& cancellation)
+{
+    return ParallelFor(s, r, f, AutoPartitioner(), cancellation);
+}
+
+template<typename R, typename F>
+Future<void> ParallelFor(TaskScheduler& s, R const& r, F f)
+{
+    return ParallelFor(s, r, f, AutoPartitioner(), CancellationToken());
 }
 
 }}
 
-#endif
\ No newline at end of file
+#endif
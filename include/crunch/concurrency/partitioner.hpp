@@ -0,0 +1,58 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_PARTITIONER_HPP
+#define CRUNCH_CONCURRENCY_PARTITIONER_HPP
+
+#include "crunch/base/noncopyable.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+namespace Detail
+{
+    struct ParallelForAffinity;
+}
+
+// Policies for how ParallelFor splits its range into tasks
+
+// Split all the way down to the grain size up front, one task per split
+class SimplePartitioner {};
+
+// Split up front into about one part per context, then lazily while running, only when the context's queue has run
+// dry and idle contexts would find no work. Sub-ranges still go down to the grain size, but are mostly run in sequence.
+// The default
+class AutoPartitioner {};
+
+// Split up front into one contiguous block per context of the scheduler, and never further. Lowest overhead for loops
+// of uniform cost per iteration, but nothing to balance load with otherwise.
+// Ranges must support proportional splits, see SplitRange(). Splittable ranges under twice the grain size are halved,
+// so blocks can be down to half the grain size, as with the other partitioners
+class StaticPartitioner {};
+
+// Split up front into a fixed number of blocks per context, and record the context that ran each block. Passing the
+// same partitioner to the next ParallelFor over the same range posts each block to the context that ran it last, so
+// repeated sweeps find their data in that context's caches. Contexts that run dry still take posted blocks from others.
+// Ranges must support proportional splits, see SplitRange().
+// Holds state between invocations, so must outlive the returned future and not be used by concurrent invocations
+class AffinityPartitioner : NonCopyable
+{
+public:
+    explicit AffinityPartitioner(std::uint32_t blocksPerContext = 4)
+        : mBlocksPerContext(blocksPerContext == 0 ? 1 : blocksPerContext)
+    {}
+
+private:
+    friend struct Detail::ParallelForAffinity;
+
+    std::uint32_t mBlocksPerContext;
+
+    // Context that last ran each block. Reset when the number of blocks changes
+    std::vector<std::uint32_t> mContextIds;
+};
+
+}}
+
+#endif
@@ -0,0 +1,94 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_PROCESSOR_TOPOLOGY_HPP
+#define CRUNCH_CONCURRENCY_PROCESSOR_TOPOLOGY_HPP
+
+#include "crunch/concurrency/tasks_api.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+// Location of a logical processor. Ids are unique across the system, and processors sharing a resource share its id
+struct ProcessorInfo
+{
+    ProcessorInfo()
+        : processor(0)
+        , core(0)
+        , cache(0)
+        , node(0)
+    {}
+
+    ProcessorInfo(std::uint32_t processor, std::uint32_t core, std::uint32_t cache, std::uint32_t node)
+        : processor(processor)
+        , core(core)
+        , cache(cache)
+        , node(node)
+    {}
+
+    std::uint32_t processor;
+    std::uint32_t core;  // SMT siblings share a core
+    std::uint32_t cache; // Last level cache
+    std::uint32_t node;  // NUMA node
+};
+
+class ProcessorTopology
+{
+public:
+    // Closest resource shared by two processors, ordered by increasing cost of communication
+    enum Level
+    {
+        LEVEL_CORE,
+        LEVEL_CACHE,
+        LEVEL_NODE,
+        LEVEL_REMOTE,
+        LEVEL_COUNT
+    };
+
+    // Empty topology. All processors are considered to be on the same node
+    ProcessorTopology() {}
+
+    explicit ProcessorTopology(std::vector<ProcessorInfo> const& processors)
+        : mProcessors(processors)
+    {}
+
+    // Read topology from the operating system. Returns an empty topology if not supported on this platform
+    CRUNCH_CONCURRENCY_TASKS_API static ProcessorTopology Detect();
+
+    // Get the processor the calling thread is currently running on, or ~0 if unknown
+    CRUNCH_CONCURRENCY_TASKS_API static std::uint32_t GetCurrentProcessor();
+
+    bool IsEmpty() const { return mProcessors.empty(); }
+
+    std::vector<ProcessorInfo> const& GetProcessors() const { return mProcessors; }
+
+    // Returns nullptr if the processor is unknown
+    CRUNCH_CONCURRENCY_TASKS_API ProcessorInfo const* Find(std::uint32_t processor) const;
+
+    // Unknown processors are assumed to be on the same node as any other
+    static Level GetSharedLevel(ProcessorInfo const* a, ProcessorInfo const* b)
+    {
+        if (a == nullptr || b == nullptr)
+            return LEVEL_NODE;
+
+        if (a->core == b->core)
+            return LEVEL_CORE;
+
+        if (a->cache == b->cache)
+            return LEVEL_CACHE;
+
+        if (a->node == b->node)
+            return LEVEL_NODE;
+
+        return LEVEL_REMOTE;
+    }
+
+private:
+    std::vector<ProcessorInfo> mProcessors;
+};
+
+}}
+
+#endif
@@ -4,6 +4,9 @@
 #ifndef CRUNCH_CONCURRENCY_RANGE_HPP
 #define CRUNCH_CONCURRENCY_RANGE_HPP
 
+#include <cstddef>
+#include <utility>
+
 namespace Crunch { namespace Concurrency {
 
 template<typename R>
@@ -18,6 +21,14 @@ std::pair<R, R> SplitRange(const R& r)
     return r.Split();
 }
 
+// Split with lowerShare / (lowerShare + upperShare) of r in the lower part. Only needed for StaticPartitioner and
+// AffinityPartitioner
+template<typename R>
+std::pair<R, R> SplitRange(const R& r, std::size_t lowerShare, std::size_t upperShare)
+{
+    return r.Split(lowerShare, upperShare);
+}
+
 }}
 
 #endif
@@ -6,8 +6,33 @@
 
 #include "crunch/concurrency/task_scheduler.hpp"
 
+#include <utility>
+
 namespace Crunch { namespace Concurrency {
 
+namespace Detail
+{
+    // Continuation added by Task<T>::Then(), passing the antecedent's value by const reference rather than a copy
+    template<typename F, typename T>
+    class ThenFunctor
+    {
+    public:
+        ThenFunctor(F&& f, Future<T> const& antecedent)
+            : mFunctor(std::move(f))
+            , mAntecedent(antecedent)
+        {}
+
+        auto operator () () -> decltype(std::declval<F&>()(std::declval<T const&>()))
+        {
+            return mFunctor(mAntecedent.Get());
+        }
+
+    private:
+        F mFunctor;
+        Future<T> mAntecedent;
+    };
+}
+
 // High level task primitive
 template<typename ResultType>
 class Task
@@ -16,13 +41,22 @@ public:
     template<typename F>
     Task(F f, TaskScheduler& scheduler = *gDefaultTaskScheduler)
         : mScheduler(&scheduler)
-        , mFuture(scheduler.Add(f))
+        , mFuture(scheduler.Add(std::move(f)))
+    {}
+
+    // Continuations added with Then() share the cancellation token
+    template<typename F>
+    Task(F f, CancellationToken const& cancellation, TaskScheduler& scheduler = *gDefaultTaskScheduler)
+        : mScheduler(&scheduler)
+        , mFuture(scheduler.Add(std::move(f), cancellation))
+        , mCancellation(cancellation)
     {}
 
     // TODO: make private
-    Task(TaskScheduler* scheduler, Future<ResultType> future)
+    Task(TaskScheduler* scheduler, Future<ResultType> future, CancellationToken const& cancellation = CancellationToken())
         : mScheduler(scheduler)
         , mFuture(future)
+        , mCancellation(cancellation)
     {}
 
     Future<ResultType> const& GetFuture() const
@@ -31,17 +65,19 @@ public:
     }
 
     template<typename F>
-    auto Then(F f) -> Task<typename Detail::ResultOfTask<F(ResultType)>::Type>
+    auto Then(F f) -> Task<typename Detail::ResultOfTask<Detail::ThenFunctor<F, ResultType>>::Type>
     {
+        typedef typename Detail::ResultOfTask<Detail::ThenFunctor<F, ResultType>>::Type ThenResultType;
+
         IWaitable* dep = &mFuture;
-        Future<ResultType> result = mFuture;
-        Future<typename Detail::ResultOfTask<F(ResultType)>::Type> thenFuture = mScheduler->Add([=]{ return f(result.Get()); }, &dep, 1);
-        return Task<typename Detail::ResultOfTask<F(ResultType)>::Type>(mScheduler, thenFuture);
+        Future<ThenResultType> thenFuture = mScheduler->Add(Detail::ThenFunctor<F, ResultType>(std::move(f), mFuture), &dep, 1, TASK_PRIORITY_NORMAL, TaskAffinity(), mCancellation);
+        return Task<ThenResultType>(mScheduler, thenFuture, mCancellation);
     }
 
 private:
     TaskScheduler* mScheduler;
     Future<ResultType> mFuture;
+    CancellationToken mCancellation;
 };
 
 /*
@@ -67,12 +103,21 @@ public:
     template<typename F>
     Task(F f, TaskScheduler& scheduler = *gDefaultTaskScheduler)
         : mScheduler(&scheduler)
-        , mFuture(scheduler.Add(f))
+        , mFuture(scheduler.Add(std::move(f)))
+    {}
+
+    // Continuations added with Then() share the cancellation token
+    template<typename F>
+    Task(F f, CancellationToken const& cancellation, TaskScheduler& scheduler = *gDefaultTaskScheduler)
+        : mScheduler(&scheduler)
+        , mFuture(scheduler.Add(std::move(f), cancellation))
+        , mCancellation(cancellation)
     {}
 
-    Task(TaskScheduler* scheduler, Future<void> future)
+    Task(TaskScheduler* scheduler, Future<void> future, CancellationToken const& cancellation = CancellationToken())
         : mScheduler(scheduler)
         , mFuture(future)
+        , mCancellation(cancellation)
     {}
 
     Future<void> GetFuture() const
@@ -84,18 +129,19 @@ public:
     auto Then(F f) -> Task<typename Detail::ResultOfTask<F>::Type>
     {
         IWaitable* dep = &mFuture;
-        return Task<typename Detail::ResultOfTask<F>::Type>(mScheduler, mScheduler->Add(f, &dep, 1));
+        return Task<typename Detail::ResultOfTask<F>::Type>(mScheduler, mScheduler->Add(std::move(f), &dep, 1, TASK_PRIORITY_NORMAL, TaskAffinity(), mCancellation), mCancellation);
     }
 
 private:
     TaskScheduler* mScheduler;
     Future<void> mFuture;
+    CancellationToken mCancellation;
 };
 
 template<typename F>
 auto RunTask(F f) -> Task<typename Detail::ResultOfTask<F>::Type>
 {
-    return Task<typename Detail::ResultOfTask<F>::Type>(f);
+    return Task<typename Detail::ResultOfTask<F>::Type>(std::move(f));
 }
 
 template<typename R, typename F>
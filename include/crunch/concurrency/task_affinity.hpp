@@ -0,0 +1,58 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_TASK_AFFINITY_HPP
+#define CRUNCH_CONCURRENCY_TASK_AFFINITY_HPP
+
+#include <cstdint>
+
+namespace Crunch { namespace Concurrency {
+
+// Hint for where a task should run, typically where an earlier task left the data it needs in cache.
+// Tasks with affinity are posted to the mailbox of the target context, which serves its mailbox before its own queue.
+// Other contexts only take mailbox tasks when out of other work, and the hint is ignored if no context matches.
+class TaskAffinity
+{
+public:
+    TaskAffinity()
+        : mKind(KIND_NONE)
+        , mId(0)
+    {}
+
+    // Context id as returned by TaskScheduler::GetCurrentContextId()
+    static TaskAffinity ForContext(std::uint32_t contextId)
+    {
+        return TaskAffinity(KIND_CONTEXT, contextId);
+    }
+
+    // Any context entered on the given processor
+    static TaskAffinity ForProcessor(std::uint32_t processor)
+    {
+        return TaskAffinity(KIND_PROCESSOR, processor);
+    }
+
+    bool IsSet() const { return mKind != KIND_NONE; }
+    bool IsContext() const { return mKind == KIND_CONTEXT; }
+    bool IsProcessor() const { return mKind == KIND_PROCESSOR; }
+    std::uint32_t GetId() const { return mId; }
+
+private:
+    enum Kind
+    {
+        KIND_NONE,
+        KIND_CONTEXT,
+        KIND_PROCESSOR
+    };
+
+    TaskAffinity(Kind kind, std::uint32_t id)
+        : mKind(kind)
+        , mId(id)
+    {}
+
+    Kind mKind;
+    std::uint32_t mId;
+};
+
+}}
+
+#endif
@@ -6,7 +6,9 @@
 
 #include "crunch/base/noncopyable.hpp"
 
+#include "crunch/concurrency/cancellation_token.hpp"
 #include "crunch/concurrency/future.hpp"
+#include "crunch/concurrency/task_priority.hpp"
 #include "crunch/concurrency/detail/scheduled_task.hpp"
 
 namespace Crunch { namespace Concurrency {
@@ -46,8 +48,12 @@ public:
         mHasContinuation = true;
 
         // TODO: Apart from allocation and future data re-use, this code is the same as scheduler context..
-        void* allocation = AllocateContinuation(sizeof(Detail::ScheduledTask<F>));
-        Detail::ScheduledTask<F>* task = new (allocation) Detail::ScheduledTask<F>(mOwner, std::move(f), mFutureData, dependencyCount);
+        std::uint32_t allocationSize = sizeof(Detail::ScheduledTask<F>);
+        bool ownsAllocation;
+        void* allocation = AllocateContinuation(allocationSize, ownsAllocation);
+        Detail::ScheduledTask<F>* task = new (allocation) Detail::ScheduledTask<F>(mOwner, std::move(f), mFutureData, dependencyCount, allocationSize, ownsAllocation);
+        task->mPriority = mPriority;
+        task->mCancellation = mCancellation;
 
         std::uint32_t addedCount = 0;
         for (std::uint32_t i = 0; i < dependencyCount; ++i)
@@ -81,17 +87,23 @@ public:
     typedef typename FutureType::DataType FutureDataType;
     typedef typename FutureType::DataPtr FutureDataPtr;
 
-    TaskExecutionContext(TaskScheduler& owner, FutureDataType* futureData)
+    TaskExecutionContext(TaskScheduler& owner, FutureDataType* futureData, TaskPriority priority, CancellationToken const& cancellation)
         : mOwner(owner)
         , mHasContinuation(false)
         , mFutureData(futureData)
+        , mPriority(priority)
+        , mCancellation(cancellation)
     {}
 
-    virtual void* AllocateContinuation(std::size_t requiredSize) = 0;
+    // Allocate memory for continuation. allocationSize is updated to the size actually available,
+    // and ownsAllocation set if the continuation must free the memory when done
+    virtual void* AllocateContinuation(std::uint32_t& allocationSize, bool& ownsAllocation) = 0;
 
     TaskScheduler& mOwner;
     bool mHasContinuation;
     FutureDataType* mFutureData;
+    TaskPriority mPriority; // Inherited by continuations
+    CancellationToken mCancellation; // Copied, as the task is destroyed before the continuation is created
 };
 
 template<>
@@ -0,0 +1,21 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_TASK_PRIORITY_HPP
+#define CRUNCH_CONCURRENCY_TASK_PRIORITY_HPP
+
+namespace Crunch { namespace Concurrency {
+
+// Scheduling priority of tasks, highest first.
+// Continuations of a task inherit its priority.
+enum TaskPriority
+{
+    TASK_PRIORITY_HIGH,       // Latency critical work
+    TASK_PRIORITY_NORMAL,
+    TASK_PRIORITY_BACKGROUND, // Bulk work that should only use otherwise idle capacity
+    TASK_PRIORITY_COUNT
+};
+
+}}
+
+#endif
@@ -8,72 +8,127 @@
 #include "crunch/base/noncopyable.hpp"
 #include "crunch/base/novtable.hpp"
 #include "crunch/base/override.hpp"
+#include "crunch/concurrency/cancellation_token.hpp"
+#include "crunch/concurrency/event_count.hpp"
 #include "crunch/concurrency/future.hpp"
+#include "crunch/concurrency/injection_queue.hpp"
+#include "crunch/concurrency/processor_topology.hpp"
 #include "crunch/concurrency/scheduler.hpp"
 #include "crunch/concurrency/semaphore.hpp"
+#include "crunch/concurrency/task_affinity.hpp"
+#include "crunch/concurrency/task_priority.hpp"
 #include "crunch/concurrency/tasks_api.hpp"
+#include "crunch/concurrency/thread.hpp"
 #include "crunch/concurrency/thread_local.hpp"
 #include "crunch/concurrency/versioned_data.hpp"
 #include "crunch/concurrency/waitable.hpp"
 #include "crunch/concurrency/work_stealing_queue.hpp"
 #include "crunch/concurrency/detail/task_result.hpp"
 #include "crunch/concurrency/detail/scheduled_task.hpp"
+#include "crunch/concurrency/detail/adaptive_steal_policy.hpp"
+#include "crunch/concurrency/detail/fiber.hpp"
+#include "crunch/concurrency/detail/owner_counter.hpp"
 #include "crunch/concurrency/detail/scheduled_task_execution_context.hpp"
-
-// TODO: remove
 #include "crunch/concurrency/detail/system_mutex.hpp"
+#include "crunch/concurrency/detail/task_allocator.hpp"
+#include "crunch/concurrency/detail/task_future_data.hpp"
+#include "crunch/concurrency/detail/trace_ring.hpp"
+#include "crunch/concurrency/detail/when_all_node.hpp"
+#include "crunch/concurrency/detail/when_any_node.hpp"
+#include "crunch/concurrency/detail/xor_shift_random.hpp"
 
 #include <cstdint>
 #include <deque>
 #include <functional>
+#include <iosfwd>
+#include <iterator>
 #include <memory>
 #include <vector>
 #include <type_traits>
+#include <utility>
 
 namespace Crunch { namespace Concurrency {
 
+namespace Detail
+{
+    class CoroutinePromiseBase;
+}
+
 // TODO: store continuation size hint thread local per F type 
 //       would enable over-allocation on initial task to avoid further allocations for continuations
 //       only necessary when return type is void or Future<T>, i.e., continuable
 class TaskScheduler : IScheduler, NonCopyable
 {
+public:
+    // Cumulative counters over all contexts, past and present
+    struct Statistics
+    {
+        Statistics();
+
+        std::uint64_t tasksExecuted;
+        std::uint64_t tasksHandedOff;      // Executed directly after the task that made them ready, bypassing the queue
+        std::uint64_t tasksInjected;       // Taken from the injection queue of tasks added outside the scheduler
+        std::uint64_t tasksFromMailbox;    // Taken from the context's own mailbox of tasks posted with affinity to it
+        std::uint64_t tasksCancelled;      // Skipped at dispatch due to cancellation. Not included in tasksExecuted
+        std::uint64_t tasksHelped;         // Run by contexts blocked in WaitFor(). Included in tasksExecuted
+        std::uint64_t stealAttempts;
+        std::uint64_t stealSuccesses;
+        std::uint64_t stealAttemptsByLevel[ProcessorTopology::LEVEL_COUNT]; // Random victim steals, by closest resource shared with the victim
+        std::uint64_t pollingTransitions;  // Context::Run() returning State::Polling
+        std::uint64_t idleTransitions;     // Context::Run() returning State::Idle
+        std::uint64_t workerParks;         // Workers blocking for lack of work
+        std::uint64_t fibersCreated;       // Fiber stacks allocated, rather than reused from a context's pool
+        std::uint64_t fibersParked;        // Waits in WaitFor() suspending the task's fiber
+        std::uint64_t queueGrowCount;
+        std::uint64_t queueShrinkCount;
+        std::uint64_t queueHighWaterMark;  // Max tasks held by any of the contexts' priority queues
+        std::uint32_t contextCount;        // Currently entered contexts
+    };
+
+private:
+    class Fiber;
+
 public:
     // TODO: On destruction, orphan tasks
     class Context : ISchedulerContext, NonCopyable
     {
     public:
-        Context(TaskScheduler& owner);
+        // processor is where the context's thread runs, or ~0 if unknown
+        Context(TaskScheduler& owner, std::uint32_t processor);
+
+        template<typename F>
+        auto Add (F&& f) -> Future<typename Detail::ResultOfTask<F>::Type>
+        {
+            return Add(std::forward<F>(f), nullptr, 0);
+        }
+
+        template<typename F>
+        auto Add (F&& f, TaskPriority priority) -> Future<typename Detail::ResultOfTask<F>::Type>
+        {
+            return Add(std::forward<F>(f), nullptr, 0, priority);
+        }
 
         template<typename F>
-        auto Add (F f) -> Future<typename Detail::ResultOfTask<F>::Type>
+        auto Add (F&& f, TaskAffinity const& affinity, TaskPriority priority = TASK_PRIORITY_NORMAL) -> Future<typename Detail::ResultOfTask<F>::Type>
         {
-            return Add(f, nullptr, 0);
+            return Add(std::forward<F>(f), nullptr, 0, priority, affinity);
         }
 
         template<typename F>
-        auto Add (F f, IWaitable** dependencies, std::uint32_t dependencyCount) -> Future<typename Detail::ResultOfTask<F>::Type>
+        auto Add (F&& f, CancellationToken const& cancellation, TaskPriority priority = TASK_PRIORITY_NORMAL) -> Future<typename Detail::ResultOfTask<F>::Type>
         {
-            typedef Future<typename Detail::ResultOfTask<F>::Type> FutureType;
-            typedef typename FutureType::DataType FutureDataType;
-            typedef typename FutureType::DataPtr FutureDataPtr;
-
-            FutureDataType* futureData = new FutureDataType(2);
-            Detail::ScheduledTask<F>* task = new Detail::ScheduledTask<F>(mOwner, std::move(f), futureData, dependencyCount);
-
-            std::uint32_t addedCount = 0;
-            for (std::uint32_t i = 0; i < dependencyCount; ++i)
-                if (dependencies[i]->AddWaiter([=] { task->NotifyDependencyReady(); }))
-                    addedCount++;
-
-            const std::uint32_t readyCount = dependencyCount - addedCount;
-
-            if (addedCount == 0 ||
-                (readyCount > 0 && (task->mBarrierCount.Sub(readyCount) == readyCount)))
-            {
-                mTasks.Push(task);
-            }
-            
-            return FutureType(FutureDataPtr(futureData, false));
+            return Add(std::forward<F>(f), nullptr, 0, priority, TaskAffinity(), cancellation);
+        }
+
+        template<typename F>
+        auto Add (F&& f, IWaitable** dependencies, std::uint32_t dependencyCount, TaskPriority priority = TASK_PRIORITY_NORMAL, TaskAffinity const& affinity = TaskAffinity(), CancellationToken const& cancellation = CancellationToken()) -> Future<typename Detail::ResultOfTask<F>::Type>
+        {
+            Detail::ScheduledTaskBase* readyTask;
+            auto future = mOwner.CreateTask(std::forward<F>(f), dependencies, dependencyCount, priority, affinity, cancellation, readyTask);
+            if (readyTask && (!affinity.IsSet() || !mOwner.PostToMailbox(readyTask)))
+                Push(readyTask);
+
+            return future;
         }
 
 
@@ -86,50 +141,481 @@ public:
 
         friend class TaskScheduler;
 
+        void Push(Detail::ScheduledTaskBase* task)
+        {
+            mTasks[task->mPriority].Push(task);
+            mOwner.NotifyWorkAvailable();
+        }
+
+        Detail::ScheduledTaskBase* PopLocal();
+        bool IsLocalEmpty() const;
+
+        bool Matches(TaskAffinity const& affinity) const
+        {
+            return affinity.IsContext() ? affinity.GetId() == mId : affinity.GetId() == mProcessor;
+        }
+
+        // Post task to this context's mailbox. Called from any thread
+        void Post(Detail::ScheduledTaskBase* task);
+
+        // Take the next task posted to this context, in the order posted
+        Detail::ScheduledTaskBase* PopMailbox();
+
+        // Dispatch task, followed by any chain of continuations it hands off
+        void Dispatch(Detail::ScheduledTaskBase* task);
+
+        // Move injected tasks to the local queues. Returns false if there were none
+        bool TakeInjectedTasks();
+
+        // Run other tasks until waitable is ready
+        void WaitFor(IWaitable& waitable);
+        Detail::ScheduledTaskBase* StealForWait();
+        void ParkUntilReady(IWaitable& waitable);
+
+        // Fiber mode. Tasks run on fibers from a per context pool, switched to from the thread's own stack.
+        // A fiber waiting in WaitFor() switches back, leaving the thread to register it with the waitable,
+        // after which it can be resumed by any context dispatching its resume task.
+        // Return false if the fiber parked rather than completing its task
+        bool RunOnFiber(Detail::ScheduledTaskBase* task);
+        bool SwitchToFiber(Fiber* fiber);
+        void ParkFiber(IWaitable& waitable);
+        void FreeIdleFibers();
+
+        bool HasStealableWork() const;
+        State EnterIdle();
+        void AddStatistics(Statistics& statistics) const;
+        void UpdateNeighbors(std::vector<std::shared_ptr<Context>> const& contexts);
+        Detail::ScheduledTaskBase* Steal();
+        Detail::ScheduledTaskBase* StealHalfFrom(Context& victim);
+        Detail::ScheduledTaskBase* TakeMailboxFrom(Context& victim);
+
         TaskScheduler& mOwner;
-        WorkStealingTaskQueue mTasks;
+        std::uint32_t mId; // Unique among entered contexts. Ids are reused after contexts leave
+        Detail::TaskAllocator* mAllocator;
+        Detail::TraceRing* mTrace; // Null if tracing is disabled
+        WorkStealingTaskQueue mTasks[TASK_PRIORITY_COUNT];
+
+        // Lower priority levels are served first every StarvationInterval local pops, so they are never starved
+        static std::uint32_t const StarvationInterval = 16;
+        std::uint32_t mPopCount;
+        std::uint32_t const mProcessor; // Processor the context was entered on, or ~0 if unknown
+        ProcessorInfo const* mProcessorInfo; // Topology of mProcessor, or nullptr if unknown
+        Detail::XorShiftRandom mRandom;
         std::uint32_t mContextsVersion;
-        std::uint32_t const mMaxStealAttemptsBeforeIdle;
+        Detail::AdaptiveStealPolicy mStealPolicy;
+        std::uint32_t const mMinStealAttemptsBeforeRemote;
         std::uint32_t mStealAttemptCount;
+        bool mIsWorker; // Owned by the scheduler, parking on mOwner.mWorkerEvent rather than through the meta scheduler
+
+        // First task made ready by the task being dispatched. Run next without going through the queue
+        static std::uint32_t const MaxHandOffChainLength = 64;
+        Detail::ScheduledTaskBase* mNextTask;
+        bool mHandOffAllowed;
+        TaskPriority mDispatchPriority; // Only continuations of the same or higher priority are handed off
+        CancellationToken const* mDispatchCancellation; // Token of the task being dispatched, inherited by tasks it adds. Null if none
+
+        // Tasks posted with affinity to this context, served before local tasks. Other contexts only take them when out of work.
+        // Cleared on Leave(), after which posting threads forward tasks to the injection queue instead
+        InjectionQueue<Detail::ScheduledTaskBase> mMailbox;
+        Detail::ScheduledTaskBase* mMailboxTasks; // Taken from mMailbox but not yet run, oldest first
+        Atomic<std::uint32_t> mActive;
+
+        // Id of the context that last stole from this one. Written by thieves. Waiting contexts help it first,
+        // as it most likely holds the task being waited for
+        Atomic<std::uint32_t> mLastThiefId;
+
+        Fiber* mCurrentFiber; // Fiber running a task on this context, or null while on the thread's own stack
+        IWaitable* mParkWaitable; // Set by a fiber switching back to the thread to park until the waitable is ready
+        std::vector<Fiber*> mIdleFibers;
+#if defined (CRUNCH_CONCURRENCY_HAS_FIBERS)
+        Detail::FiberContext mThreadFiberContext; // Where fibers return to when done or parking
+#endif
+
+        // Updated by the owning thread only. Aligned to keep them off lines read by thieves
+        struct CRUNCH_ALIGN_PREFIX(128) Counters
+        {
+            Detail::OwnerCounter tasksExecuted;
+            Detail::OwnerCounter tasksHandedOff;
+            Detail::OwnerCounter tasksInjected;
+            Detail::OwnerCounter tasksFromMailbox;
+            Detail::OwnerCounter tasksCancelled;
+            Detail::OwnerCounter tasksHelped;
+            Detail::OwnerCounter stealAttempts;
+            Detail::OwnerCounter stealSuccesses;
+            Detail::OwnerCounter stealAttemptsByLevel[ProcessorTopology::LEVEL_COUNT];
+            Detail::OwnerCounter pollingTransitions;
+            Detail::OwnerCounter idleTransitions;
+            Detail::OwnerCounter workerParks;
+            Detail::OwnerCounter fibersCreated;
+            Detail::OwnerCounter fibersParked;
+        } CRUNCH_ALIGN_POSTFIX(128);
+
+        Counters mCounters;
+
+        // Neighbors sorted by closest shared resource. Neighbors sharing level L are in [mLevelEnds[L - 1], mLevelEnds[L])
         std::vector<std::shared_ptr<Context>> mNeighbors;
+        std::uint32_t mLevelEnds[ProcessorTopology::LEVEL_COUNT];
+    };
+
+    struct Config
+    {
+        Config()
+            : workerCount(0)
+            , idleSpinCount(256)
+            , minStealAttempts(2)
+            , maxStealAttempts(1024)
+            , traceCapacity(0)
+            , useFibers(false)
+            , fiberStackSize(128 * 1024)
+            , maxIdleFibers(16)
+        {}
+
+        // Number of worker threads started and owned by the scheduler.
+        // With 0 workers, threads must Enter() and drive contexts through GetContext().Run()
+        std::uint32_t workerCount;
+
+        // Optional processor ids to pin workers to. Worker i is pinned to workerAffinity[i % workerAffinity.size()]
+        std::vector<std::uint32_t> workerAffinity;
+
+        // Number of pause iterations idle workers poll for work before parking
+        std::uint32_t idleSpinCount;
+
+        // Bounds for the adaptive number of failed steal attempts before a context goes idle
+        std::uint32_t minStealAttempts;
+        std::uint32_t maxStealAttempts;
+
+        // Number of most recent events traced per context. 0 disables tracing.
+        // Has no effect if tracing is compiled out with CRUNCH_CONCURRENCY_TASKS_TRACING
+        std::uint32_t traceCapacity;
+
+        // Run tasks on fibers with their own stacks, so that a task waiting in WaitFor() suspends its fiber and frees the
+        // context to run other tasks, instead of running them nested on its stack. The task may resume on another context.
+        // Costs two fiber switches per task. Ignored where fibers are not supported, see CRUNCH_CONCURRENCY_HAS_FIBERS
+        bool useFibers;
+        std::uint32_t fiberStackSize; // Usable stack per fiber, rounded up to whole pages. Followed by a guard page
+        std::uint32_t maxIdleFibers; // Fibers kept per context for reuse. Others are freed when their task completes
+
+        // Processor topology used to steal from the closest contexts first. Detected from the system if empty
+        ProcessorTopology topology;
+    };
 
-        std::vector<Detail::ScheduledTaskBase*> mRunLog; // Log of tasks run, for debugging
+    // Snapshot of a context's adaptive stealing state
+    struct StealPolicyState
+    {
+        std::uint32_t attemptBudget;  // Failed steal attempts before going idle
+        std::uint32_t backoffLimit;   // Max pause iterations between steal attempts
+        double successRate;           // Recent fraction of steal attempts succeeding
+        double meanIdleMicroseconds;  // Recent average time from going idle until finding work
     };
 
-    CRUNCH_CONCURRENCY_TASKS_API TaskScheduler();
+    static std::uint32_t const InvalidContextId = ~std::uint32_t(0);
+
+    CRUNCH_CONCURRENCY_TASKS_API explicit TaskScheduler(Config const& config = Config());
+
+    // Stops and joins any worker threads. All other contexts must have left. Tasks still queued are cancelled
+    CRUNCH_CONCURRENCY_TASKS_API ~TaskScheduler();
+
+    template<typename F>
+    auto Add(F&& f) -> Future<typename Detail::ResultOfTask<F>::Type>
+    {
+        return Add(std::forward<F>(f), nullptr, 0);
+    }
+
+    template<typename F>
+    auto Add(F&& f, TaskPriority priority) -> Future<typename Detail::ResultOfTask<F>::Type>
+    {
+        return Add(std::forward<F>(f), nullptr, 0, priority);
+    }
+
+    // Run f preferably on the context given by affinity. The hint is ignored if no entered context matches
+    template<typename F>
+    auto Add(F&& f, TaskAffinity const& affinity, TaskPriority priority = TASK_PRIORITY_NORMAL) -> Future<typename Detail::ResultOfTask<F>::Type>
+    {
+        return Add(std::forward<F>(f), nullptr, 0, priority, affinity);
+    }
+
+    // Skip f if cancellation is cancelled before it starts. Tasks added by f inherit the token
+    template<typename F>
+    auto Add(F&& f, CancellationToken const& cancellation, TaskPriority priority = TASK_PRIORITY_NORMAL) -> Future<typename Detail::ResultOfTask<F>::Type>
+    {
+        return Add(std::forward<F>(f), nullptr, 0, priority, TaskAffinity(), cancellation);
+    }
 
     template<typename F>
-    auto Add(F f) -> Future<typename Detail::ResultOfTask<F>::Type>
+    auto Add(F&& f, IWaitable** dependencies, std::uint32_t dependencyCount, TaskPriority priority = TASK_PRIORITY_NORMAL, TaskAffinity const& affinity = TaskAffinity(), CancellationToken const& cancellation = CancellationToken()) -> Future<typename Detail::ResultOfTask<F>::Type>
     {
         Context* context = GetContextInternal();
-        if (context)
-            return context->Add(f);
-        else
-            return mSharedContext.Add(f);
+        if (context && &context->mOwner == this)
+            return context->Add(std::forward<F>(f), dependencies, dependencyCount, priority, affinity, cancellation);
+
+        // Not running inside this scheduler. Hand ready work to the workers through the injection queue
+        Detail::ScheduledTaskBase* readyTask;
+        auto future = CreateTask(std::forward<F>(f), dependencies, dependencyCount, priority, affinity, cancellation, readyTask);
+        if (readyTask && (!affinity.IsSet() || !PostToMailbox(readyTask)))
+        {
+            mInjectedTasks.Push(readyTask);
+            NotifyWorkAvailable();
+        }
+
+        return future;
     }
 
+    // Run f without creating a future, for work whose completion is observed by other means, e.g., a join. Saves the
+    // future data and its reference counting. f takes no arguments and returns nothing. If cancellation is unset, the
+    // token of the calling task is inherited, and a skipped f is destroyed without running
     template<typename F>
-    auto Add(F f, IWaitable** dependencies, std::uint32_t dependencyCount) -> Future<typename Detail::ResultOfTask<F>::Type>
+    void AddDetached(F&& f, TaskPriority priority, TaskAffinity const& affinity, CancellationToken const& cancellation)
     {
+        typedef Detail::DetachedTask<typename std::decay<F>::type> TaskType;
+        static_assert(std::is_void<decltype(std::declval<typename std::decay<F>::type&>()())>::value, "Detached tasks have no result");
+
+        std::uint32_t allocationSize = sizeof(TaskType);
+        void* const allocation = AllocateTask(allocationSize);
+        TaskType* task = new (allocation) TaskType(*this, std::forward<F>(f), allocationSize);
+        task->mPriority = priority;
+        task->mAffinity = affinity;
+        if (cancellation.IsSet())
+            task->mCancellation = cancellation;
+        else if (CancellationToken const* inherited = GetDispatchCancellation())
+            task->mCancellation = *inherited;
+        CRUNCH_CONCURRENCY_TASKS_TRACE(GetTraceRing(), Detail::TRACE_EVENT_SPAWN, reinterpret_cast<std::uintptr_t>(task));
+
+        if (affinity.IsSet() && PostToMailbox(task))
+            return;
+
         Context* context = GetContextInternal();
-        if (context)
-            return context->Add(f, dependencies, dependencyCount);
+        if (context && &context->mOwner == this)
+            context->Push(task);
         else
-            return mSharedContext.Add(f, dependencies, dependencyCount);
+        {
+            mInjectedTasks.Push(task);
+            NotifyWorkAvailable();
+        }
+    }
+
+    template<typename F>
+    void AddDetached(F&& f, CancellationToken const& cancellation = CancellationToken())
+    {
+        AddDetached(std::forward<F>(f), TASK_PRIORITY_NORMAL, TaskAffinity(), cancellation);
+    }
+
+    // Run f to produce a result in destination, which must outlive the task. The future only signals completion, so
+    // no space is allocated for the value. If f takes a T&, it fills destination in place, with no temporary, e.g., for
+    // large arrays or structs. Otherwise f takes no arguments, and its result is move-assigned to destination.
+    // f must not return a future. If the task is cancelled, destination is left untouched
+    template<typename T, typename F>
+    Future<void> AddInto(T& destination, F&& f, IWaitable** dependencies = nullptr, std::uint32_t dependencyCount = 0, TaskPriority priority = TASK_PRIORITY_NORMAL, TaskAffinity const& affinity = TaskAffinity(), CancellationToken const& cancellation = CancellationToken())
+    {
+        typedef typename Detail::PlacementFunctor<T, typename std::decay<F>::type>::Type FunctorType;
+        return Add(FunctorType(destination, std::forward<F>(f)), dependencies, dependencyCount, priority, affinity, cancellation);
+    }
+
+    // Future ready once all waitables in [begin, end) are, for elements being waitables or pointers to them.
+    // Unlike adding a task with dependencies, no task is run, and each waitable costs an intrusive waiter and a single
+    // atomic decrement. Joins of up to about 16 waitables fit a single block from the task allocator.
+    // The future completes cancelled if the token, or without one the token of the calling task, is cancelled by then
+    template<typename Iterator>
+    Future<void> WhenAll(Iterator begin, Iterator end, CancellationToken const& cancellation = CancellationToken())
+    {
+        typedef Detail::WhenAllNode NodeType;
+
+        Future<void> future;
+        std::uint32_t const count = static_cast<std::uint32_t>(std::distance(begin, end));
+        NodeType* node = CreateWhenAllNode(count, cancellation, future);
+
+        std::uint32_t readyCount = 0;
+        NodeType::JoinWaiter* waiter = node->GetWaiters();
+        for (Iterator it = begin; it != end; ++it, ++waiter)
+            if (!Detail::GetWaitable(*it).AddWaiter(static_cast<Waiter*>(new (waiter) NodeType::JoinWaiter(node))))
+                readyCount++;
+
+        node->Arrive(readyCount + 1);
+
+        return future;
+    }
+
+    // Join over work only known as it is spawned, with a single counter rather than a waiter per piece of work.
+    // The node owes one arrival to the caller, and Expect(1) must be called for each further piece of work before the
+    // caller's arrival, with the piece arriving once done. future is set to complete after the last arrival, cancelled
+    // under the same conditions as WhenAll()
+    Detail::WhenAllNode* CreateJoin(Future<void>& future, CancellationToken const& cancellation = CancellationToken())
+    {
+        return CreateWhenAllNode(0, cancellation, future);
+    }
+
+    // Future of the index of the first waitable in the range [begin, end) to become ready, without running a task.
+    // The winner's value is read from the input itself, so it is never copied. If losers is set, it is cancelled as soon as
+    // there is a winner, which skips or stops the remaining inputs if they were added with it. Futures returned by the
+    // scheduler that were cancelled do not win. If all inputs were cancelled, or the range is empty, the future is cancelled
+    template<typename Iterator>
+    Future<std::uint32_t> WhenAny(Iterator begin, Iterator end, CancellationToken const& losers = CancellationToken())
+    {
+        typedef Detail::WhenAnyNode NodeType;
+        typedef NodeType::FutureDataType FutureDataType;
+
+        std::uint32_t const count = static_cast<std::uint32_t>(std::distance(begin, end));
+        std::uint32_t allocationSize = static_cast<std::uint32_t>(NodeType::GetSize(count));
+        char* allocation = static_cast<char*>(AllocateTask(allocationSize));
+        FutureDataType* futureData = FutureDataType::Create(allocation, allocationSize, 2);
+        NodeType* node = new (allocation + NodeType::GetOffset()) NodeType(futureData, count, losers);
+
+        // Stop registering once there is a winner, and account for the rest in one go
+        std::uint32_t index = 0;
+        NodeType::AnyWaiter* waiter = node->GetWaiters();
+        for (Iterator it = begin; it != end && !node->IsClaimed(); ++it, ++waiter, ++index)
+        {
+            Detail::WhenAnyInput const input = Detail::MakeWhenAnyInput(*it);
+            new (waiter) NodeType::AnyWaiter(node, index, input);
+            if (!input.waitable->AddWaiter(static_cast<Waiter*>(waiter)))
+                node->Arrive(waiter->GetReadyIndex(), 1);
+        }
+
+        node->Arrive(NodeType::NoIndex, count - index + 1);
+
+        return Future<std::uint32_t>(Future<std::uint32_t>::DataPtr(futureData, false));
     }
 
     CRUNCH_CONCURRENCY_TASKS_API void Enter();
     CRUNCH_CONCURRENCY_TASKS_API void Leave();
 
+    // Block until waitable is ready. Called from a context of this scheduler, e.g., from within a task,
+    // the context keeps running its own tasks and stealing while waiting, trying the thief of its work first.
+    // This avoids both idling the thread and deadlocking when all workers wait. Other threads simply block.
+    // In fiber mode, a task instead suspends its fiber and lets the context move on, and may resume on another thread.
+    // Call before Future::Get() to get a helping wait
+    CRUNCH_CONCURRENCY_TASKS_API void WaitFor(IWaitable& waitable);
+
+    // Id of the calling thread's context, for TaskAffinity::ForContext(). InvalidContextId if not entered in this scheduler
+    std::uint32_t GetCurrentContextId() const
+    {
+        Context* context = GetContextInternal();
+        return context && &context->mOwner == this ? context->mId : InvalidContextId;
+    }
+
+    // True if the calling context has no queued tasks left for others to steal, e.g., because they were stolen.
+    // Lets a task split off work lazily, only when idle contexts would otherwise find none, and run it sequentially
+    // while there is queued work. Also true if not entered in this scheduler
+    bool IsLocalQueueEmpty() const
+    {
+        Context* context = GetContextInternal();
+        return context == nullptr || &context->mOwner != this || context->IsLocalEmpty();
+    }
+
+    // Snapshot of scheduler counters. Counters are sampled individually without stopping or synchronizing with contexts,
+    // so are only approximately consistent with each other while work is running
+    CRUNCH_CONCURRENCY_TASKS_API Statistics GetStatistics();
+
+    // Number of contexts running tasks, i.e., entered threads and workers, including workers still starting up
+    CRUNCH_CONCURRENCY_TASKS_API std::uint32_t GetContextCount();
+
+    // Steal policy state of all entered contexts. Values are sampled without synchronizing with the contexts
+    CRUNCH_CONCURRENCY_TASKS_API std::vector<StealPolicyState> GetStealPolicyStates();
+
+    // Write traced events of all contexts, past and present, in the Chrome trace event JSON format.
+    // Load in chrome://tracing or ui.perfetto.dev. Can be called while contexts are running
+    CRUNCH_CONCURRENCY_TASKS_API void WriteTrace(std::ostream& stream);
+
     CRUNCH_CONCURRENCY_TASKS_API virtual ISchedulerContext& GetContext() CRUNCH_OVERRIDE;
     virtual bool CanOrphan() CRUNCH_OVERRIDE { return true; }
 
 private:
     friend class Detail::ScheduledTaskBase;
+    friend class Detail::CoroutinePromiseBase;
+    template<typename T> friend class Detail::TaskFutureData;
 
     CRUNCH_CONCURRENCY_TASKS_API static Context* GetContextInternal();
+    static Detail::TraceRing* GetTraceRing();
+    static CancellationToken const* GetDispatchCancellation();
     CRUNCH_CONCURRENCY_TASKS_API void AddTask(Detail::ScheduledTaskBase* task);
 
+    // Post task to the mailbox of the context matching its affinity. Returns false if the calling context matches,
+    // or no context does, in which case the task must be queued as usual
+    CRUNCH_CONCURRENCY_TASKS_API bool PostToMailbox(Detail::ScheduledTaskBase* task);
+
+    // Push a list linked through Detail::GetNext to the injection queue
+    void InjectTasks(Detail::ScheduledTaskBase* tasks);
+
+    // Wake an idle context, if any, after making work available
+    void NotifyWorkAvailable();
+    CRUNCH_CONCURRENCY_TASKS_API void WakeIdleContext();
+
+    void Enter(std::uint32_t processor);
+    void RunWorker(std::uint32_t index);
+    void ParkWorker(Context& context);
+
+    // Node with room for count waiters, co-allocated with the data of future
+    Detail::WhenAllNode* CreateWhenAllNode(std::uint32_t count, CancellationToken const& cancellation, Future<void>& future)
+    {
+        typedef Detail::WhenAllNode NodeType;
+        typedef NodeType::FutureDataType FutureDataType;
+
+        std::uint32_t allocationSize = static_cast<std::uint32_t>(NodeType::GetSize(count));
+        char* allocation = static_cast<char*>(AllocateTask(allocationSize));
+        FutureDataType* futureData = FutureDataType::Create(allocation, allocationSize, 2);
+
+        CancellationToken const* inherited = GetDispatchCancellation();
+        NodeType* node = new (allocation + NodeType::GetOffset()) NodeType(
+            futureData, count, cancellation.IsSet() || inherited == nullptr ? cancellation : *inherited);
+
+        future = Future<void>(Future<void>::DataPtr(futureData, false));
+        return node;
+    }
+
+    // Allocate task memory from the calling context's allocator, or the shared allocator if called from outside the scheduler
+    void* AllocateTask(std::uint32_t& allocationSize);
+    static void FreeTask(void* allocation, std::uint32_t allocationSize);
+    CRUNCH_CONCURRENCY_TASKS_API void* AllocateTaskShared(std::uint32_t allocationSize);
+
+    // Allocate a coroutine frame from the calling context's allocator, whichever scheduler it belongs to.
+    // Threads outside any scheduler allocate from the shared allocator of the default scheduler
+    static void* AllocateFrame(std::uint32_t& allocationSize);
+
+    // Create task and register it with its dependencies. Without a cancellation token, the token of the calling task is inherited.
+    // readyTask is set to the task if it can run immediately and must be queued by the caller, otherwise to nullptr.
+    template<typename F>
+    auto CreateTask(F&& f, IWaitable** dependencies, std::uint32_t dependencyCount, TaskPriority priority, TaskAffinity const& affinity, CancellationToken const& cancellation, Detail::ScheduledTaskBase*& readyTask) -> Future<typename Detail::ResultOfTask<F>::Type>
+    {
+        typedef typename Detail::ResultOfTask<F>::Type ResultType;
+        typedef Future<ResultType> FutureType;
+        typedef typename FutureType::DataPtr FutureDataPtr;
+        typedef Detail::FusedTaskLayout<ResultType, typename std::decay<F>::type> Layout;
+        typedef typename Layout::FutureDataType FutureDataType;
+        typedef typename Layout::TaskType TaskType;
+
+        // Future data and task share a single allocation, owned by the future data
+        std::uint32_t const taskOffset = static_cast<std::uint32_t>(Layout::GetTaskOffset());
+        std::uint32_t allocationSize = static_cast<std::uint32_t>(Layout::GetSize());
+        char* allocation = static_cast<char*>(AllocateTask(allocationSize));
+        FutureDataType* futureData = FutureDataType::Create(allocation, allocationSize, 2);
+        TaskType* task = new (allocation + taskOffset) TaskType(*this, std::forward<F>(f), futureData, dependencyCount, allocationSize - taskOffset, false);
+        task->mPriority = priority;
+        task->mAffinity = affinity;
+        if (cancellation.IsSet())
+            task->mCancellation = cancellation;
+        else if (CancellationToken const* inherited = GetDispatchCancellation())
+            task->mCancellation = *inherited;
+        CRUNCH_CONCURRENCY_TASKS_TRACE(GetTraceRing(), Detail::TRACE_EVENT_SPAWN, reinterpret_cast<std::uintptr_t>(task));
+
+        std::uint32_t addedCount = 0;
+        for (std::uint32_t i = 0; i < dependencyCount; ++i)
+            if (dependencies[i]->AddWaiter([=] { task->NotifyDependencyReady(); }))
+                addedCount++;
+
+        const std::uint32_t readyCount = dependencyCount - addedCount;
+
+        if (addedCount == 0 ||
+            (readyCount > 0 && (task->mBarrierCount.Sub(readyCount) == readyCount)))
+        {
+            readyTask = task;
+        }
+        else
+        {
+            readyTask = nullptr;
+        }
+
+        return FutureType(FutureDataPtr(futureData, false));
+    }
+
     // Contexts cache configuration locally and poll mConfigurationVersion for changes
     /*
     Detail::SystemMutex mConfigurationMutex;
@@ -139,19 +625,66 @@ private:
     typedef std::vector<std::shared_ptr<Context>> ContextList;
     VersionedData<ContextList> mContexts;
 
-    // Number of idle contexts
+    // Counters accumulated from contexts that have left. Guarded by the lock in mContexts
+    Statistics mRetiredStatistics;
+
+    // Number of idle contexts driven through the meta scheduler. Incremented by contexts returning State::Idle from Run(),
+    // and decremented when posting mWorkAvailable
     Atomic<std::uint32_t> mIdleCount;
     Semaphore mWorkAvailable;
 
-    // TODO: Need to lock around shared context
-    // TODO: Might be better of with a more specialized queue instead of a shared context
-    Context mSharedContext;
+    // Worker threads owned by the scheduler. Idle workers park on mWorkerEvent
+    Config const mConfig;
+    ProcessorTopology const mTopology;
+    Atomic<std::uint32_t> mStopping;
+    std::vector<std::unique_ptr<Thread>> mWorkers;
+
+    // Fibers parked in WaitFor() and not yet resumed. They are only reachable through the waitable they are registered
+    // with, so can't be released by the scheduler. Must be zero on destruction
+    Atomic<std::uint32_t> mParkedFiberCount;
+    EventCount mWorkerEvent;
+
+    // Tasks added from threads outside the scheduler. Drained in batches by contexts in Run()
+    InjectionQueue<Detail::ScheduledTaskBase> mInjectedTasks;
+
+    // Task allocators are handed to contexts on Enter() and returned to the idle list on Leave().
+    // They live as long as the scheduler, as tasks allocated by a context can outlive it.
+    Detail::SystemMutex mAllocatorsMutex;
+    std::vector<std::unique_ptr<Detail::TaskAllocator>> mAllocators;
+    std::vector<Detail::TaskAllocator*> mIdleAllocators;
+
+    // Trace rings are handed out like allocators, and kept for writing traces after contexts leave. Guarded by mAllocatorsMutex
+    std::vector<std::unique_ptr<Detail::TraceRing>> mTraceRings;
+    std::vector<Detail::TraceRing*> mIdleTraceRings;
+
+    // Context ids are handed out like allocators, to keep them small and stable for use in affinity hints. Guarded by mAllocatorsMutex
+    std::uint32_t mContextIdCount;
+    std::vector<std::uint32_t> mIdleContextIds;
+
+    // Allocator for tasks created outside the scheduler. Guarded by mSharedAllocatorMutex
+    Detail::SystemMutex mSharedAllocatorMutex;
+    Detail::TaskAllocator mSharedAllocator;
 
     static CRUNCH_THREAD_LOCAL Context* tContext;
 };
 
 CRUNCH_CONCURRENCY_TASKS_API extern TaskScheduler* gDefaultTaskScheduler;
 
+// True if the task producing the future was skipped due to cancellation. Only valid for futures returned by TaskScheduler
+template<typename T>
+bool IsCancelled(Future<T> const& future)
+{
+    return static_cast<Detail::TaskFutureData<T> const*>(future.GetData())->IsCancelled();
+}
+
+// Wait for the value of future and move it out, e.g., std::vector<int> v = TakeResult(std::move(future)).
+// Only moved if no other future shares the data, so nothing else can observe it, and copied otherwise
+template<typename T>
+T TakeResult(Future<T>&& future)
+{
+    return Detail::TakeFutureValue(future);
+}
+
 #if !defined (VPM_SHARED_LIBS_BUILD)
 inline TaskScheduler::Context* TaskScheduler::GetContextInternal()
 {
@@ -159,13 +692,106 @@ inline TaskScheduler::Context* TaskScheduler::GetContextInternal()
 }
 #endif
 
+inline Detail::TraceRing* TaskScheduler::GetTraceRing()
+{
+    Context* context = GetContextInternal();
+    return context ? context->mTrace : nullptr;
+}
+
+inline CancellationToken const* TaskScheduler::GetDispatchCancellation()
+{
+    Context* context = GetContextInternal();
+    return context ? context->mDispatchCancellation : nullptr;
+}
+
+inline bool TaskScheduler::Context::IsLocalEmpty() const
+{
+    for (std::uint32_t level = 0; level < TASK_PRIORITY_COUNT; ++level)
+        if (!mTasks[level].IsEmpty())
+            return false;
+
+    return true;
+}
+
 inline void TaskScheduler::AddTask(Detail::ScheduledTaskBase* task)
 {
+    if (task->mAffinity.IsSet() && PostToMailbox(task))
+        return;
+
+    Context* context = GetContextInternal();
+    if (context && &context->mOwner == this)
+    {
+        // Hand off the first task made ready by the running task, so it runs next while its inputs are cache hot
+        if (context->mHandOffAllowed && context->mNextTask == nullptr && task->mPriority <= context->mDispatchPriority)
+            context->mNextTask = task;
+        else
+            context->Push(task);
+    }
+    else
+    {
+        mInjectedTasks.Push(task);
+        NotifyWorkAvailable();
+    }
+}
+
+inline void TaskScheduler::NotifyWorkAvailable()
+{
+    // Only costs a fence and loads unless a context is parked.
+    // The fence in NotifyOne() also orders the preceding push before reading the idle count,
+    // pairing with Context::EnterIdle(), which checks for work after incrementing the idle count
+    mWorkerEvent.NotifyOne();
+    if (mIdleCount.Load(MEMORY_ORDER_RELAXED) != 0)
+        WakeIdleContext();
+}
+
+inline void* TaskScheduler::AllocateTask(std::uint32_t& allocationSize)
+{
+    allocationSize = Detail::TaskAllocator::GetAllocationSize(allocationSize);
+
     Context* context = GetContextInternal();
     if (context && &context->mOwner == this)
-        context->mTasks.Push(task);
+        return context->mAllocator->Allocate(allocationSize);
     else
-        mSharedContext.mTasks.Push(task);
+        return AllocateTaskShared(allocationSize);
+}
+
+inline void* TaskScheduler::AllocateFrame(std::uint32_t& allocationSize)
+{
+    allocationSize = Detail::TaskAllocator::GetAllocationSize(allocationSize);
+
+    Context* context = GetContextInternal();
+    if (context)
+        return context->mAllocator->Allocate(allocationSize);
+
+    CRUNCH_ASSERT_MSG(gDefaultTaskScheduler != nullptr, "Coroutines created outside of a scheduler require a default scheduler");
+    return gDefaultTaskScheduler->AllocateTaskShared(allocationSize);
+}
+
+inline void TaskScheduler::FreeTask(void* allocation, std::uint32_t allocationSize)
+{
+    // Any allocator owned by this thread can free locally, regardless of which scheduler it belongs to
+    Context* context = GetContextInternal();
+    Detail::TaskAllocator::Free(allocation, allocationSize, context ? context->mAllocator : nullptr);
+}
+
+namespace Detail
+{
+    inline void* ScheduledTaskBase::Allocate(TaskScheduler& owner, std::uint32_t& allocationSize)
+    {
+        return owner.AllocateTask(allocationSize);
+    }
+
+    inline void ScheduledTaskBase::Free(void* allocation, std::uint32_t allocationSize)
+    {
+        TaskScheduler::FreeTask(allocation, allocationSize);
+    }
+
+    template<typename T>
+    void TaskFutureData<T>::operator delete(void* p)
+    {
+        FusedTaskHeader* const header = reinterpret_cast<FusedTaskHeader*>(static_cast<char*>(p) - GetOffset());
+        TaskScheduler::FreeTask(header, header->allocationSize);
+    }
 }
 
 }}
@@ -16,4 +16,11 @@
 #   define CRUNCH_CONCURRENCY_TASKS_API
 #endif
 
+// Coroutine tasks require compiler and library support for C++20 coroutines
+#if defined (__cpp_impl_coroutine) && defined (__has_include)
+#   if __has_include(<coroutine>)
+#       define CRUNCH_CONCURRENCY_HAS_COROUTINES
+#   endif
+#endif
+
 #endif
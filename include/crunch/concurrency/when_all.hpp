@@ -0,0 +1,31 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_WHEN_ALL_HPP
+#define CRUNCH_CONCURRENCY_WHEN_ALL_HPP
+
+#include "crunch/concurrency/task_scheduler.hpp"
+
+#include <iterator>
+#include <type_traits>
+
+namespace Crunch { namespace Concurrency {
+
+// Future ready once all of the given futures are. See TaskScheduler::WhenAll()
+template<typename Future0, typename... Futures>
+Future<void> WhenAll(TaskScheduler& scheduler, Future0 const& future0, Futures const&... futures)
+{
+    IWaitable const* waitables[] = { &future0, &futures... };
+    return scheduler.WhenAll(waitables, waitables + 1 + sizeof...(Futures));
+}
+
+// Future ready once all futures in range are, e.g., a std::vector<Future<T>>
+template<typename Range>
+auto WhenAll(TaskScheduler& scheduler, Range const& range) -> typename std::enable_if<!std::is_base_of<IWaitable, Range>::value, Future<void>>::type
+{
+    return scheduler.WhenAll(std::begin(range), std::end(range));
+}
+
+}}
+
+#endif
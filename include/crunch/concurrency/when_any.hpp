@@ -0,0 +1,40 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_WHEN_ANY_HPP
+#define CRUNCH_CONCURRENCY_WHEN_ANY_HPP
+
+#include "crunch/concurrency/task_scheduler.hpp"
+
+#include <iterator>
+#include <type_traits>
+
+namespace Crunch { namespace Concurrency {
+
+// Future of the index of the first of the given futures to become ready. losers is cancelled once there is a winner.
+// It comes first, as it can not follow the futures. See TaskScheduler::WhenAny()
+template<typename Future0, typename... Futures>
+Future<std::uint32_t> WhenAny(TaskScheduler& scheduler, CancellationToken const& losers, Future0 const& future0, Futures const&... futures)
+{
+    Detail::WhenAnyInput const inputs[] = { Detail::MakeWhenAnyInput(future0), Detail::MakeWhenAnyInput(futures)... };
+    return scheduler.WhenAny(inputs, inputs + 1 + sizeof...(Futures), losers);
+}
+
+template<typename Future0, typename... Futures>
+auto WhenAny(TaskScheduler& scheduler, Future0 const& future0, Futures const&... futures)
+    -> typename std::enable_if<std::is_base_of<IWaitable, Future0>::value, Future<std::uint32_t>>::type
+{
+    return WhenAny(scheduler, CancellationToken(), future0, futures...);
+}
+
+// Future of the index of the first future in range to become ready. losers is cancelled once there is a winner
+template<typename Range>
+auto WhenAny(TaskScheduler& scheduler, Range const& range, CancellationToken const& losers = CancellationToken())
+    -> typename std::enable_if<!std::is_base_of<IWaitable, Range>::value, Future<std::uint32_t>>::type
+{
+    return scheduler.WhenAny(std::begin(range), std::end(range), losers);
+}
+
+}}
+
+#endif
@@ -10,14 +10,13 @@
 #include "crunch/base/memory.hpp"
 #include "crunch/concurrency/atomic.hpp"
 #include "crunch/concurrency/mpmc_lifo_list.hpp"
+#include "crunch/concurrency/detail/owner_counter.hpp"
 
+#include <algorithm>
 #include <cstdint>
 
 namespace Crunch { namespace Concurrency {
 
-// TODO: steal half work queues
-// TODO: adaptive work stealing A-STEAL
-
 namespace Detail
 {
     struct WorkStealingQueueFreeListNode
@@ -193,9 +192,17 @@ public:
         {
             array = array->Grow(front, back);
             mArray.Store(array, MEMORY_ORDER_RELEASE);
+            mCounters.growCount.Increment();
         }
         array->Set(back, value);
         mBack.Store(back + 1, MEMORY_ORDER_RELEASE);
+        mCounters.highWaterMark.Max(static_cast<std::uint64_t>(size + 1));
+    }
+
+    // Approximate check for elements. Can be called from any thread
+    bool IsEmpty() const
+    {
+        return mBack.Load(MEMORY_ORDER_ACQUIRE) - mFront.Load(MEMORY_ORDER_ACQUIRE) <= 0;
     }
 
     // Fraction of spaced used to trigger shrink. Must be >= 3.
@@ -231,6 +238,7 @@ public:
                     mBack.Store(back);
 
                 array->Destroy();
+                mCounters.shrinkCount.Increment();
             }
             return value;
         }
@@ -266,12 +274,75 @@ public:
         return value;
     }
 
+    struct Statistics
+    {
+        std::uint64_t growCount;
+        std::uint64_t shrinkCount;
+        std::uint64_t highWaterMark; // Max number of elements held
+    };
+
+    // Can be called from any thread. Counters are sampled individually, without synchronizing with the owner
+    Statistics GetStatistics() const
+    {
+        Statistics statistics;
+        statistics.growCount = mCounters.growCount.Get();
+        statistics.shrinkCount = mCounters.shrinkCount.Get();
+        statistics.highWaterMark = mCounters.highWaterMark.Get();
+        return statistics;
+    }
+
+    // Upper bound on the number of elements moved by a single StealHalf()
+    static std::uint32_t const MaxStealHalfCount = 64;
+
+    // Steal up to half of the elements in this queue in one go.
+    // The first element stolen is returned, the rest are pushed onto destination, which must be owned by the caller.
+    // Elements are claimed one by one through the regular Steal() protocol, one CAS each, so this saves the thief
+    // repeated victim searches but no synchronization. A single CAS over the range is not safe, as the owner's Pop()
+    // takes any but the last element without one, and may then push into a slot the thief already copied.
+    // Stops early on the first failed steal.
+    T* StealHalf(WorkStealingQueue& destination, std::uint32_t maxCount = MaxStealHalfCount)
+    {
+        CRUNCH_ASSERT(&destination != this);
+
+        std::int64_t const front = mFront.Load(MEMORY_ORDER_ACQUIRE);
+        std::int64_t const back = mBack.Load(MEMORY_ORDER_ACQUIRE);
+        std::int64_t const size = back - front;
+        if (size <= 0)
+            return nullptr; // Empty
+
+        T* const first = Steal();
+        if (first == nullptr)
+            return nullptr;
+
+        std::int64_t remaining = std::min<std::int64_t>((size + 1) / 2, maxCount) - 1;
+        while (remaining-- > 0)
+        {
+            T* const value = Steal();
+            if (value == nullptr)
+                break;
+
+            destination.Push(value);
+        }
+
+        return first;
+    }
+
 private:
     void Grow();
 
     Atomic<std::int64_t> mFront;
     Atomic<std::int64_t> mBack;
     Atomic<CircularArray*> mArray;
+
+    // Updated by the owner only. Kept apart from the indices to avoid false sharing with thieves
+    struct CRUNCH_ALIGN_PREFIX(128) Counters
+    {
+        Detail::OwnerCounter growCount;
+        Detail::OwnerCounter shrinkCount;
+        Detail::OwnerCounter highWaterMark;
+    } CRUNCH_ALIGN_POSTFIX(128);
+
+    Counters mCounters;
 };
 
 template<typename T>
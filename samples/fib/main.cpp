@@ -80,40 +80,20 @@ void FibSample()
     MetaScheduler::Config config;
     MetaScheduler metaScheduler(config);
     MetaScheduler::Context& metaSchedulerContext = metaScheduler.AcquireContext();
-    TaskScheduler scheduler;
+    TaskScheduler::Config schedulerConfig;
+    schedulerConfig.workerCount = 2;
+    TaskScheduler scheduler(schedulerConfig);
     // TODO: pass flag to TaskScheduler constructor to say if it should become the global default scheduler
     gDefaultTaskScheduler = &scheduler;
     scheduler.Enter();
 
-    NullThrottler throttler;
-
-    volatile bool done = false;
-
-    Thread t1([&] {
-        scheduler.Enter();
-        while (!done)
-            scheduler.GetContext().Run(throttler);
-        scheduler.Leave();
-    });
-
-    Thread t2([&] {
-        scheduler.Enter();
-        while (!done)
-            scheduler.GetContext().Run(throttler);
-        scheduler.Leave();
-    });
-
     int x = 20;
     Future<int> y = ParFib2(x);
-    WaitFor(y);
+    scheduler.WaitFor(y);
     std::cout << "ParFib(" << x << ") = " << y.Get() << std::endl;
     std::cout << "Fib(" << x << ") = " << Fib(x) << std::endl;
 
 
-    done = true;
-    t1.Join();
-    t2.Join();
-
     scheduler.Leave();
     metaSchedulerContext.Release();
 }
@@ -0,0 +1,56 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/event_count.hpp"
+
+#if defined (CRUNCH_PLATFORM_WIN32)
+#   include <windows.h>
+// WaitOnAddress and WakeByAddress* live in Synchronization.lib
+#   pragma comment(lib, "Synchronization.lib")
+#elif defined (CRUNCH_PLATFORM_LINUX)
+#   include <linux/futex.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#   include <climits>
+#endif
+
+namespace Crunch { namespace Concurrency {
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "Futex word must be a plain 32 bit integer");
+
+void EventCount::Notify(bool all)
+{
+    mEpoch.fetch_add(1, std::memory_order_release);
+
+#if defined (CRUNCH_PLATFORM_WIN32)
+    if (all)
+        ::WakeByAddressAll(&mEpoch);
+    else
+        ::WakeByAddressSingle(&mEpoch);
+#elif defined (CRUNCH_PLATFORM_LINUX)
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&mEpoch), FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, nullptr, nullptr, 0);
+#else
+    // Lock to avoid losing the notification between a waiter checking the epoch and blocking
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (all)
+        mCondition.notify_all();
+    else
+        mCondition.notify_one();
+#endif
+}
+
+void EventCount::WaitForEpochChange(Key key)
+{
+#if defined (CRUNCH_PLATFORM_WIN32)
+    ::WaitOnAddress(&mEpoch, &key, sizeof(key), INFINITE);
+#elif defined (CRUNCH_PLATFORM_LINUX)
+    // Returns immediately if the epoch is no longer key
+    ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&mEpoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mEpoch.load(std::memory_order_acquire) == key)
+        mCondition.wait(lock);
+#endif
+}
+
+}}
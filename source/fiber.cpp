@@ -0,0 +1,237 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/detail/fiber.hpp"
+
+#if defined (CRUNCH_CONCURRENCY_HAS_FIBERS)
+
+#include "crunch/base/assert.hpp"
+#include "crunch/concurrency/thread_local.hpp"
+
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined (__SANITIZE_ADDRESS__)
+#   define CRUNCH_CONCURRENCY_FIBER_ASAN
+#elif defined (__has_feature)
+#   if __has_feature(address_sanitizer)
+#       define CRUNCH_CONCURRENCY_FIBER_ASAN
+#   endif
+#endif
+
+#if defined (__SANITIZE_THREAD__)
+#   define CRUNCH_CONCURRENCY_FIBER_TSAN
+#elif defined (__has_feature)
+#   if __has_feature(thread_sanitizer)
+#       define CRUNCH_CONCURRENCY_FIBER_TSAN
+#   endif
+#endif
+
+#if defined (CRUNCH_CONCURRENCY_FIBER_ASAN)
+#   include <sanitizer/asan_interface.h>
+#endif
+
+#if defined (CRUNCH_CONCURRENCY_FIBER_TSAN)
+#   include <sanitizer/tsan_interface.h>
+#endif
+
+#if defined (CRUNCH_ARCH_X86_64)
+
+// Push the callee saved registers and control words of the System V ABI, swap stacks, and pop them from the other stack.
+// New fibers start with a frame returning to crunch_concurrency_fiber_start, with the entry function in r13 and its argument in r12
+extern "C" void crunch_concurrency_switch_stack(void** from, void* to);
+extern "C" void crunch_concurrency_fiber_start();
+
+asm(
+    ".text\n"
+    ".p2align 4\n"
+    ".type crunch_concurrency_switch_stack, @function\n"
+    "crunch_concurrency_switch_stack:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $16, %rsp\n"
+    "    stmxcsr 8(%rsp)\n"
+    "    fnstcw 12(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr 8(%rsp)\n"
+    "    fldcw 12(%rsp)\n"
+    "    addq $16, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size crunch_concurrency_switch_stack, .-crunch_concurrency_switch_stack\n"
+    ".p2align 4\n"
+    ".type crunch_concurrency_fiber_start, @function\n"
+    "crunch_concurrency_fiber_start:\n"
+    "    movq %r12, %rdi\n"
+    "    callq *%r13\n"
+    "    ud2\n"
+    ".size crunch_concurrency_fiber_start, .-crunch_concurrency_fiber_start\n");
+
+#endif
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+// Sanitizer bookkeeping around stack switches, and entry into new fibers
+struct FiberSwitch
+{
+    // Context switched from on this thread, to record its stack bounds once the switch completes
+    static CRUNCH_THREAD_LOCAL FiberContext* tFrom;
+
+    static void Begin(void** fakeStack, FiberContext& from, FiberContext& to)
+    {
+        tFrom = &from;
+#if defined (CRUNCH_CONCURRENCY_FIBER_ASAN)
+        ::__sanitizer_start_switch_fiber(fakeStack, to.mStackBottom, to.mStackSize);
+#else
+        (void)fakeStack;
+#endif
+#if defined (CRUNCH_CONCURRENCY_FIBER_TSAN)
+        ::__tsan_switch_to_fiber(to.mSanitizerFiber, 0);
+#endif
+        (void)to;
+    }
+
+    // Not inlined, as the code after a switch may run on another thread than the code before it
+    static __attribute__((noinline)) void End(void* fakeStack)
+    {
+        FiberContext* const from = tFrom;
+#if defined (CRUNCH_CONCURRENCY_FIBER_ASAN)
+        void const* stackBottom = nullptr;
+        ::__sanitizer_finish_switch_fiber(fakeStack, &stackBottom, &from->mStackSize);
+        from->mStackBottom = const_cast<void*>(stackBottom);
+#else
+        (void)fakeStack;
+        (void)from;
+#endif
+    }
+
+    static void Start(Fiber* fiber)
+    {
+        End(nullptr);
+        fiber->mEntry(fiber->mArgument);
+        CRUNCH_HALT(); // Entry functions must switch away for good rather than return
+    }
+
+#if !defined (CRUNCH_ARCH_X86_64)
+    // makecontext() only passes int arguments
+    static void StartUcontext(unsigned int high, unsigned int low)
+    {
+        Start(reinterpret_cast<Fiber*>((static_cast<std::uintptr_t>(high) << 32) | low));
+    }
+#endif
+};
+
+CRUNCH_THREAD_LOCAL FiberContext* FiberSwitch::tFrom = nullptr;
+
+namespace
+{
+    std::size_t GetPageSize()
+    {
+        return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    }
+}
+
+FiberContext::FiberContext()
+    : mStackBottom(nullptr)
+    , mStackSize(0)
+#if defined (CRUNCH_CONCURRENCY_FIBER_TSAN)
+    , mSanitizerFiber(::__tsan_get_current_fiber())
+#else
+    , mSanitizerFiber(nullptr)
+#endif
+{
+#if defined (CRUNCH_ARCH_X86_64)
+    mStackPointer = nullptr;
+#endif
+}
+
+Fiber::Fiber(std::size_t stackSize, EntryFunction entry, void* argument)
+    : mEntry(entry)
+    , mArgument(argument)
+{
+    std::size_t const pageSize = GetPageSize();
+    std::size_t const usableSize = (stackSize + pageSize - 1) / pageSize * pageSize;
+    mMappingSize = usableSize + pageSize;
+    mMapping = ::mmap(nullptr, mMappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mMapping == MAP_FAILED)
+        throw std::bad_alloc();
+
+    // Stacks grow down, so the guard page goes at the bottom
+    if (::mprotect(mMapping, pageSize, PROT_NONE) != 0)
+    {
+        ::munmap(mMapping, mMappingSize);
+        throw std::bad_alloc();
+    }
+
+    char* const bottom = static_cast<char*>(mMapping) + pageSize;
+    mContext.mStackBottom = bottom;
+    mContext.mStackSize = usableSize;
+#if defined (CRUNCH_CONCURRENCY_FIBER_TSAN)
+    mContext.mSanitizerFiber = ::__tsan_create_fiber(0);
+#endif
+
+#if defined (CRUNCH_ARCH_X86_64)
+    // Initial frame as pushed by crunch_concurrency_switch_stack, returning to the start trampoline with the stack aligned as on a call
+    std::uint64_t* const top = reinterpret_cast<std::uint64_t*>(bottom + usableSize);
+    std::uint64_t* const frame = top - 9;
+    frame[0] = 0;
+    frame[1] = 0;
+
+    // Default MXCSR and x87 control word, in the slots read by ldmxcsr 8(%rsp) and fldcw 12(%rsp)
+    reinterpret_cast<std::uint32_t*>(frame)[2] = 0x1F80;
+    reinterpret_cast<std::uint16_t*>(frame)[6] = 0x037F;
+    frame[2] = 0; // r15
+    frame[3] = 0; // r14
+    frame[4] = reinterpret_cast<std::uint64_t>(&FiberSwitch::Start); // r13
+    frame[5] = reinterpret_cast<std::uint64_t>(this); // r12
+    frame[6] = 0; // rbx
+    frame[7] = 0; // rbp
+    frame[8] = reinterpret_cast<std::uint64_t>(&crunch_concurrency_fiber_start);
+    mContext.mStackPointer = frame;
+#else
+    ::getcontext(&mContext.mContext);
+    mContext.mContext.uc_stack.ss_sp = bottom;
+    mContext.mContext.uc_stack.ss_size = usableSize;
+    mContext.mContext.uc_link = nullptr;
+    std::uintptr_t const self = reinterpret_cast<std::uintptr_t>(this);
+    ::makecontext(&mContext.mContext, reinterpret_cast<void (*)()>(&FiberSwitch::StartUcontext), 2,
+        static_cast<unsigned int>(self >> 32), static_cast<unsigned int>(self));
+#endif
+}
+
+Fiber::~Fiber()
+{
+#if defined (CRUNCH_CONCURRENCY_FIBER_TSAN)
+    ::__tsan_destroy_fiber(mContext.mSanitizerFiber);
+#endif
+    ::munmap(mMapping, mMappingSize);
+}
+
+void SwitchFiber(FiberContext& from, FiberContext& to)
+{
+    void* fakeStack = nullptr;
+    FiberSwitch::Begin(&fakeStack, from, to);
+#if defined (CRUNCH_ARCH_X86_64)
+    crunch_concurrency_switch_stack(&from.mStackPointer, to.mStackPointer);
+#else
+    ::swapcontext(&from.mContext, &to.mContext);
+#endif
+    FiberSwitch::End(fakeStack);
+}
+
+}}}
+
+#endif
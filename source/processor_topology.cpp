@@ -0,0 +1,168 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/processor_topology.hpp"
+#include "crunch/base/platform.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined (CRUNCH_PLATFORM_WIN32)
+#   include <windows.h>
+#elif defined (CRUNCH_PLATFORM_LINUX)
+#   include <dirent.h>
+#   include <sched.h>
+#endif
+
+namespace Crunch { namespace Concurrency {
+
+#if defined (CRUNCH_PLATFORM_LINUX)
+namespace
+{
+    bool ReadLine(std::string const& path, std::string& line)
+    {
+        FILE* file = std::fopen(path.c_str(), "r");
+        if (file == nullptr)
+            return false;
+
+        char buffer[256];
+        bool const success = std::fgets(buffer, sizeof(buffer), file) != nullptr;
+        std::fclose(file);
+
+        if (success)
+            line.assign(buffer, std::strcspn(buffer, "\n"));
+
+        return success;
+    }
+
+    // Reads a single number, or the first number of a list like "0-3,8-11"
+    bool ReadFirstNumber(std::string const& path, std::uint32_t& value)
+    {
+        std::string line;
+        if (!ReadLine(path, line) || line.empty())
+            return false;
+
+        char* end;
+        unsigned long const parsed = std::strtoul(line.c_str(), &end, 10);
+        if (end == line.c_str())
+            return false;
+
+        value = static_cast<std::uint32_t>(parsed);
+        return true;
+    }
+
+    // Identify last level cache by the lowest processor sharing it
+    bool ReadLastLevelCache(std::string const& cpuPath, std::uint32_t& cache)
+    {
+        std::uint32_t maxLevel = 0;
+        for (int index = 0; ; ++index)
+        {
+            std::string const indexPath = cpuPath + "/cache/index" + std::to_string(index);
+            std::uint32_t level;
+            if (!ReadFirstNumber(indexPath + "/level", level))
+                break;
+
+            std::uint32_t firstShared;
+            if (level >= maxLevel && ReadFirstNumber(indexPath + "/shared_cpu_list", firstShared))
+            {
+                maxLevel = level;
+                cache = firstShared;
+            }
+        }
+
+        return maxLevel != 0;
+    }
+
+    // Processor directories link to their NUMA node as nodeN
+    bool ReadNode(std::string const& cpuPath, std::uint32_t& node)
+    {
+        DIR* dir = ::opendir(cpuPath.c_str());
+        if (dir == nullptr)
+            return false;
+
+        bool found = false;
+        while (dirent* entry = ::readdir(dir))
+        {
+            if (std::strncmp(entry->d_name, "node", 4) == 0 && std::isdigit(static_cast<unsigned char>(entry->d_name[4])))
+            {
+                node = static_cast<std::uint32_t>(std::strtoul(entry->d_name + 4, nullptr, 10));
+                found = true;
+                break;
+            }
+        }
+
+        ::closedir(dir);
+        return found;
+    }
+}
+#endif
+
+ProcessorTopology ProcessorTopology::Detect()
+{
+    std::vector<ProcessorInfo> processors;
+
+#if defined (CRUNCH_PLATFORM_LINUX)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (::sched_getaffinity(0, sizeof(set), &set) != 0)
+        return ProcessorTopology();
+
+    // Only consider processors available to this process, as offline processors have no topology information
+    for (std::uint32_t processor = 0; processor < CPU_SETSIZE; ++processor)
+    {
+        if (!CPU_ISSET(processor, &set))
+            continue;
+
+        std::string const cpuPath = "/sys/devices/system/cpu/cpu" + std::to_string(processor);
+
+        ProcessorInfo info;
+        info.processor = processor;
+
+        // Identify core by the lowest SMT sibling
+        if (!ReadFirstNumber(cpuPath + "/topology/thread_siblings_list", info.core))
+            info.core = processor;
+
+        // Without NUMA information, treat each package as a node
+        if (!ReadNode(cpuPath, info.node) &&
+            !ReadFirstNumber(cpuPath + "/topology/physical_package_id", info.node))
+        {
+            info.node = 0;
+        }
+
+        // Without cache information, assume cache is shared by the whole node.
+        // Offset to keep ids unique, as they would otherwise clash with processor ids
+        if (!ReadLastLevelCache(cpuPath, info.cache))
+            info.cache = CPU_SETSIZE + info.node;
+
+        processors.push_back(info);
+    }
+#endif
+
+    return ProcessorTopology(processors);
+}
+
+std::uint32_t ProcessorTopology::GetCurrentProcessor()
+{
+#if defined (CRUNCH_PLATFORM_WIN32)
+    return static_cast<std::uint32_t>(::GetCurrentProcessorNumber());
+#elif defined (CRUNCH_PLATFORM_LINUX)
+    int const processor = ::sched_getcpu();
+    return processor < 0 ? ~std::uint32_t(0) : static_cast<std::uint32_t>(processor);
+#else
+    return ~std::uint32_t(0);
+#endif
+}
+
+ProcessorInfo const* ProcessorTopology::Find(std::uint32_t processor) const
+{
+    for (auto it = mProcessors.begin(); it != mProcessors.end(); ++it)
+        if (it->processor == processor)
+            return &*it;
+
+    return nullptr;
+}
+
+}}
@@ -0,0 +1,86 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/detail/task_allocator.hpp"
+#include "crunch/base/memory.hpp"
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+std::uint32_t const TaskAllocator::MinLogBlockSize;
+std::uint32_t const TaskAllocator::SizeClassCount;
+std::uint32_t const TaskAllocator::MaxBlockSize;
+std::size_t const TaskAllocator::SlabSize;
+
+TaskAllocator::TaskAllocator()
+    : mSlabs(nullptr)
+{
+    for (std::uint32_t i = 0; i < SizeClassCount; ++i)
+    {
+        mFreeLists[i] = nullptr;
+        mSlabBegin[i] = nullptr;
+        mSlabEnd[i] = nullptr;
+    }
+}
+
+TaskAllocator::~TaskAllocator()
+{
+    // Count blocks in use per slab, as blocks carved from it less free blocks in it
+    for (Slab* slab = mSlabs; slab != nullptr; slab = slab->next)
+    {
+        std::uint32_t const blockSize = GetBlockSize(slab->sizeClass);
+        char* const base = reinterpret_cast<char*>(slab);
+        char* const carvedEnd = mSlabEnd[slab->sizeClass] == base + SlabSize ? mSlabBegin[slab->sizeClass] : base + SlabSize;
+        slab->liveCount.Store(static_cast<std::uint32_t>((carvedEnd - base) / blockSize) - 1, MEMORY_ORDER_RELAXED);
+    }
+
+    for (std::uint32_t i = 0; i < SizeClassCount; ++i)
+    {
+        for (Block* block = mFreeLists[i]; block != nullptr; block = block->next)
+            Slab::FromBlock(block)->liveCount.Decrement(MEMORY_ORDER_RELAXED);
+
+        for (Block* block = mRemoteFreeLists[i].head.Swap(nullptr, MEMORY_ORDER_ACQUIRE); block != nullptr; block = block->next)
+            Slab::FromBlock(block)->liveCount.Decrement(MEMORY_ORDER_RELAXED);
+    }
+
+    while (mSlabs)
+    {
+        Slab* const next = mSlabs->next;
+        if (mSlabs->liveCount.Load(MEMORY_ORDER_RELAXED) == 0)
+            FreeAligned(mSlabs);
+        else
+            mSlabs->owner = nullptr;
+
+        mSlabs = next;
+    }
+}
+
+void* TaskAllocator::AllocateFromSlab(std::uint32_t sizeClass)
+{
+    std::uint32_t const blockSize = GetBlockSize(sizeClass);
+
+    if (mSlabBegin[sizeClass] == mSlabEnd[sizeClass])
+    {
+        Slab* const slab = new (MallocAligned(SlabSize, SlabSize)) Slab();
+        slab->owner = this;
+        slab->sizeClass = sizeClass;
+        slab->next = mSlabs;
+        mSlabs = slab;
+
+        // First block holds the slab header. Keeps remaining blocks aligned to their size
+        char* const base = reinterpret_cast<char*>(slab);
+        mSlabBegin[sizeClass] = base + blockSize;
+        mSlabEnd[sizeClass] = base + SlabSize;
+    }
+
+    void* const block = mSlabBegin[sizeClass];
+    mSlabBegin[sizeClass] += blockSize;
+    return block;
+}
+
+void TaskAllocator::FreeOrphaned(Slab* slab)
+{
+    if (slab->liveCount.Decrement(MEMORY_ORDER_ACQ_REL) == 1)
+        FreeAligned(slab);
+}
+
+}}}
@@ -2,13 +2,97 @@
 // Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
 
 #include "crunch/concurrency/task_scheduler.hpp"
+#include "crunch/concurrency/detail/cpu_pause.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#if defined (CRUNCH_PLATFORM_WIN32)
+#   include <windows.h>
+#elif defined (CRUNCH_PLATFORM_LINUX)
+#   include <pthread.h>
+#   include <sched.h>
+#endif
 
 namespace Crunch { namespace Concurrency {
+
+namespace
+{
+    std::uint64_t GetTimestampNanoseconds()
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void SetCurrentThreadAffinity(std::uint32_t processor)
+    {
+#if defined (CRUNCH_PLATFORM_WIN32)
+        ::SetThreadAffinityMask(::GetCurrentThread(), DWORD_PTR(1) << processor);
+#elif defined (CRUNCH_PLATFORM_LINUX)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(processor, &set);
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+#else
+        (void)processor; // Pinning not supported
+#endif
+    }
+
+    // Yields from TaskScheduler::Context::Run() when the scheduler is shutting down
+    class WorkerThrottler : public IThrottler
+    {
+    public:
+        WorkerThrottler(Atomic<std::uint32_t> const& stopping)
+            : mStopping(stopping)
+        {}
+
+        virtual bool ShouldYield() CRUNCH_OVERRIDE
+        {
+            return mStopping.Load(MEMORY_ORDER_RELAXED) != 0;
+        }
+
+    private:
+        Atomic<std::uint32_t> const& mStopping;
+    };
+
+    // Wakes a context parked in TaskScheduler::Context::WaitFor(), by notifying the event it is parked on
+    class WakeWaiter : public Waiter
+    {
+    public:
+        explicit WakeWaiter(EventCount& event)
+            : Waiter(&Notify)
+            , mEvent(event)
+            , mDone(0)
+        {}
+
+        bool IsDone() const
+        {
+            return mDone.Load(MEMORY_ORDER_ACQUIRE) != 0;
+        }
+
+    private:
+        static void Notify(Waiter* waiter)
+        {
+            WakeWaiter* const self = static_cast<WakeWaiter*>(waiter);
+            EventCount& event = self->mEvent;
+
+            // The waiting context may return as soon as done is set, so the waiter must not be touched after
+            self->mDone.Store(1, MEMORY_ORDER_RELEASE);
+            event.NotifyAll();
+        }
+
+        EventCount& mEvent;
+        Atomic<std::uint32_t> mDone;
+    };
+}
  
 TaskScheduler* gDefaultTaskScheduler = nullptr;
 
 CRUNCH_THREAD_LOCAL TaskScheduler::Context* TaskScheduler::tContext = nullptr;
 
+std::uint32_t const TaskScheduler::InvalidContextId;
+
 #if defined (VPM_SHARED_LIBS_BUILD)
 TaskScheduler::Context* TaskScheduler::GetContextInternal()
 {
@@ -16,23 +100,179 @@ TaskScheduler::Context* TaskScheduler::GetContextInternal()
 }
 #endif
 
-#if defined (CRUNCH_COMPILER_MSVC)
-#   pragma warning (push)
-#   pragma warning (disable : 4355) // 'this' used in base member initializer list
-#endif
+TaskScheduler::Statistics::Statistics()
+    : tasksExecuted(0)
+    , tasksHandedOff(0)
+    , tasksInjected(0)
+    , tasksFromMailbox(0)
+    , tasksCancelled(0)
+    , tasksHelped(0)
+    , stealAttempts(0)
+    , stealSuccesses(0)
+    , pollingTransitions(0)
+    , idleTransitions(0)
+    , workerParks(0)
+    , fibersCreated(0)
+    , fibersParked(0)
+    , queueGrowCount(0)
+    , queueShrinkCount(0)
+    , queueHighWaterMark(0)
+    , contextCount(0)
+{
+    std::fill(stealAttemptsByLevel, stealAttemptsByLevel + ProcessorTopology::LEVEL_COUNT, 0);
+}
 
-TaskScheduler::TaskScheduler()
-    : mSharedContext(*this)
-{}
+TaskScheduler::TaskScheduler(Config const& config)
+    : mIdleCount(0)
+    , mConfig(config)
+    , mTopology(config.topology.IsEmpty() ? ProcessorTopology::Detect() : config.topology)
+    , mStopping(0)
+    , mParkedFiberCount(0)
+    , mContextIdCount(0)
+{
+    for (std::uint32_t i = 0; i < mConfig.workerCount; ++i)
+        mWorkers.push_back(std::unique_ptr<Thread>(new Thread([this, i] { RunWorker(i); })));
+}
 
-#if defined (CRUNCH_COMPILER_MSVC)
-#   pragma warning (pop)
-#endif
+TaskScheduler::~TaskScheduler()
+{
+    mStopping.Store(1);
+    mWorkerEvent.NotifyAll();
+
+    for (std::size_t i = 0; i < mWorkers.size(); ++i)
+        mWorkers[i]->Join();
+
+    CRUNCH_ASSERT(mIdleAllocators.size() == mAllocators.size());
+
+    // A task is still waiting for something that never became ready, and its fiber would leak
+    CRUNCH_ASSERT(mParkedFiberCount.Load(MEMORY_ORDER_ACQUIRE) == 0);
+
+    // Nothing is left to run tasks still queued, so cancel them. This completes their futures and frees their memory,
+    // which would otherwise keep the allocator's slabs alive. Cancelling may make further tasks ready, which are queued here too
+    while (Detail::ScheduledTaskBase* task = mInjectedTasks.PopAll())
+    {
+        do
+        {
+            Detail::ScheduledTaskBase* next = Detail::GetNext(*task);
+            task->Cancel();
+            task = next;
+        }
+        while (task);
+    }
+}
+
+void TaskScheduler::RunWorker(std::uint32_t index)
+{
+    if (!mConfig.workerAffinity.empty())
+    {
+        // Pinned, so the worker is known to run on the processor even before the thread has migrated there
+        std::uint32_t const processor = mConfig.workerAffinity[index % mConfig.workerAffinity.size()];
+        SetCurrentThreadAffinity(processor);
+        Enter(processor);
+    }
+    else
+    {
+        Enter();
+    }
+
+    Context& context = *tContext;
+    context.mIsWorker = true;
+
+    WorkerThrottler throttler(mStopping);
+    while (mStopping.Load(MEMORY_ORDER_RELAXED) == 0)
+    {
+        if (context.Run(throttler) == ISchedulerContext::State::Idle)
+            ParkWorker(context);
+    }
+
+    Leave();
+}
+
+void TaskScheduler::ParkWorker(Context& context)
+{
+    // Work often shows up again shortly, and parking costs a system call for both the worker and whoever wakes it
+    for (std::uint32_t i = 0; i < mConfig.idleSpinCount; ++i)
+    {
+        if (context.HasStealableWork() || mStopping.Load(MEMORY_ORDER_RELAXED) != 0)
+            return;
+
+        Detail::CpuPause();
+    }
+
+    // Work made available after PrepareWait() is either seen by the check, or sees this worker waiting and wakes it
+    EventCount::Key const key = mWorkerEvent.PrepareWait();
+    if (context.HasStealableWork() || mStopping.Load(MEMORY_ORDER_RELAXED) != 0)
+        mWorkerEvent.CancelWait();
+    else
+    {
+        CRUNCH_CONCURRENCY_TASKS_TRACE(context.mTrace, Detail::TRACE_EVENT_PARK, 0);
+        context.mCounters.workerParks.Increment();
+        mWorkerEvent.Wait(key);
+        CRUNCH_CONCURRENCY_TASKS_TRACE(context.mTrace, Detail::TRACE_EVENT_UNPARK, 0);
+    }
+}
+
+void TaskScheduler::WakeIdleContext()
+{
+    std::uint32_t idleCount = mIdleCount.Load(MEMORY_ORDER_RELAXED);
+    while (idleCount != 0)
+    {
+        if (mIdleCount.CompareAndSwap(idleCount, idleCount - 1))
+        {
+            mWorkAvailable.Post();
+            return;
+        }
+
+        idleCount = mIdleCount.Load(MEMORY_ORDER_RELAXED);
+    }
+}
 
 void TaskScheduler::Enter()
+{
+    Enter(ProcessorTopology::GetCurrentProcessor());
+}
+
+void TaskScheduler::Enter(std::uint32_t processor)
 {
     CRUNCH_ASSERT_ALWAYS(tContext == nullptr);
-    tContext = new Context(*this);
+    tContext = new Context(*this, processor);
+
+    {
+        Detail::SystemMutex::ScopedLock lock(mAllocatorsMutex);
+        if (mIdleAllocators.empty())
+        {
+            mAllocators.push_back(std::unique_ptr<Detail::TaskAllocator>(new Detail::TaskAllocator()));
+            tContext->mAllocator = mAllocators.back().get();
+        }
+        else
+        {
+            tContext->mAllocator = mIdleAllocators.back();
+            mIdleAllocators.pop_back();
+        }
+
+        if (mIdleContextIds.empty())
+            tContext->mId = mContextIdCount++;
+        else
+        {
+            tContext->mId = mIdleContextIds.back();
+            mIdleContextIds.pop_back();
+        }
+
+        if (mConfig.traceCapacity != 0)
+        {
+            if (mIdleTraceRings.empty())
+            {
+                std::uint32_t const id = static_cast<std::uint32_t>(mTraceRings.size());
+                mTraceRings.push_back(std::unique_ptr<Detail::TraceRing>(new Detail::TraceRing(id, mConfig.traceCapacity)));
+                tContext->mTrace = mTraceRings.back().get();
+            }
+            else
+            {
+                tContext->mTrace = mIdleTraceRings.back();
+                mIdleTraceRings.pop_back();
+            }
+        }
+    }
 
     mContexts.Update([] (ContextList& contexts)
     {
@@ -44,34 +284,426 @@ void TaskScheduler::Leave()
 {
     CRUNCH_ASSERT_ALWAYS(tContext != nullptr);
     tContext->mNeighbors.clear(); // TODO: move to Context::Cleanup()
-    mContexts.Update([] (ContextList& contexts)
+    tContext->FreeIdleFibers();
+
+    // Forward tasks posted to this context to the other contexts. Pairs with the fence in Context::Post(),
+    // so threads posting after this either have their task taken here, or see the context inactive and forward it themselves
+    tContext->mActive.Store(0, MEMORY_ORDER_RELAXED);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    InjectTasks(tContext->mMailboxTasks);
+    InjectTasks(tContext->mMailbox.PopAll());
+    tContext->mMailboxTasks = nullptr;
+
+    // Likewise queued tasks, which would otherwise be lost with the context
+    for (std::uint32_t level = 0; level < TASK_PRIORITY_COUNT; ++level)
+    {
+        while (Detail::ScheduledTaskBase* task = tContext->mTasks[level].Pop())
+        {
+            mInjectedTasks.Push(task);
+            NotifyWorkAvailable();
+        }
+    }
+
+    {
+        Detail::SystemMutex::ScopedLock lock(mAllocatorsMutex);
+        mIdleAllocators.push_back(tContext->mAllocator);
+        tContext->mAllocator = nullptr;
+        mIdleContextIds.push_back(tContext->mId);
+
+        if (tContext->mTrace)
+        {
+            mIdleTraceRings.push_back(tContext->mTrace);
+            tContext->mTrace = nullptr;
+        }
+    }
+
+    mContexts.Update([this] (ContextList& contexts)
     {
         Context* context = tContext;
+        context->AddStatistics(mRetiredStatistics);
         contexts.erase(std::find_if(contexts.begin(), contexts.end(), [context] (std::shared_ptr<Context> const& p) { return p.get() == context; }));
     });
 
     tContext = nullptr;
 }
 
+bool TaskScheduler::PostToMailbox(Detail::ScheduledTaskBase* task)
+{
+    TaskAffinity const& affinity = task->mAffinity;
+
+    Context* context = GetContextInternal();
+    if (context && &context->mOwner == this)
+    {
+        if (context->Matches(affinity))
+            return false;
+
+        // Neighbors are kept alive by the context's snapshot, so posting needs no lock
+        mContexts.ReadIfDifferent(context->mContextsVersion, [context] (ContextList const& contexts)
+        {
+            context->UpdateNeighbors(contexts);
+        });
+
+        for (auto it = context->mNeighbors.begin(); it != context->mNeighbors.end(); ++it)
+        {
+            if ((*it)->Matches(affinity))
+            {
+                (*it)->Post(task);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    Context* target = nullptr;
+    mContexts.Read([&] (ContextList const& contexts)
+    {
+        for (auto it = contexts.begin(); it != contexts.end(); ++it)
+        {
+            if ((*it)->Matches(affinity))
+            {
+                target = it->get();
+                target->Post(task);
+                break;
+            }
+        }
+    });
+
+    return target != nullptr;
+}
+
+void TaskScheduler::WaitFor(IWaitable& waitable)
+{
+    Context* context = tContext;
+    if (context && &context->mOwner == this)
+        context->WaitFor(waitable);
+    else
+        Concurrency::WaitFor(waitable);
+}
+
+void TaskScheduler::InjectTasks(Detail::ScheduledTaskBase* tasks)
+{
+    if (tasks == nullptr)
+        return;
+
+    do
+    {
+        Detail::ScheduledTaskBase* next = Detail::GetNext(*tasks);
+        mInjectedTasks.Push(tasks);
+        tasks = next;
+    }
+    while (tasks);
+
+    NotifyWorkAvailable();
+}
+
+void* TaskScheduler::AllocateTaskShared(std::uint32_t allocationSize)
+{
+    Detail::SystemMutex::ScopedLock lock(mSharedAllocatorMutex);
+    return mSharedAllocator.Allocate(allocationSize);
+}
+
+TaskScheduler::Statistics TaskScheduler::GetStatistics()
+{
+    Statistics statistics;
+    mContexts.Read([&] (ContextList const& contexts)
+    {
+        statistics = mRetiredStatistics;
+        for (auto it = contexts.begin(); it != contexts.end(); ++it)
+            (*it)->AddStatistics(statistics);
+
+        statistics.contextCount = static_cast<std::uint32_t>(contexts.size());
+    });
+
+    return statistics;
+}
+
+std::uint32_t TaskScheduler::GetContextCount()
+{
+    std::uint32_t count = 0;
+    mContexts.Read([&] (ContextList const& contexts)
+    {
+        count = static_cast<std::uint32_t>(contexts.size());
+    });
+
+    // Workers may not have entered yet
+    return std::max(count, mConfig.workerCount);
+}
+
+std::vector<TaskScheduler::StealPolicyState> TaskScheduler::GetStealPolicyStates()
+{
+    std::vector<StealPolicyState> states;
+    mContexts.Read([&] (ContextList const& contexts)
+    {
+        for (auto it = contexts.begin(); it != contexts.end(); ++it)
+        {
+            Detail::AdaptiveStealPolicy const& policy = (*it)->mStealPolicy;
+            StealPolicyState state;
+            state.attemptBudget = policy.GetAttemptBudget();
+            state.backoffLimit = policy.GetBackoffLimit();
+            state.successRate = double(policy.GetSuccessRate()) / Detail::AdaptiveStealPolicy::RateOne;
+            state.meanIdleMicroseconds = double(policy.GetMeanIdleNanoseconds()) / 1000;
+            states.push_back(state);
+        }
+    });
+
+    return states;
+}
+
+void TaskScheduler::WriteTrace(std::ostream& stream)
+{
+    std::vector<Detail::TraceRing const*> rings;
+    {
+        Detail::SystemMutex::ScopedLock lock(mAllocatorsMutex);
+        for (auto it = mTraceRings.begin(); it != mTraceRings.end(); ++it)
+            rings.push_back(it->get());
+    }
+
+    // Rings live as long as the scheduler, so can be read outside the lock
+    Detail::WriteChromeTrace(stream, rings);
+}
+
 ISchedulerContext& TaskScheduler::GetContext()
 {
     CRUNCH_ASSERT(tContext != nullptr);
     return *tContext;
 }
 
-TaskScheduler::Context::Context(TaskScheduler& owner)
+#if defined (CRUNCH_CONCURRENCY_HAS_FIBERS)
+
+// Stack for running tasks in fiber mode. Runs one task at a time, and is pooled by the context it completes on
+class TaskScheduler::Fiber : NonCopyable
+{
+public:
+    // Queued once the waitable a parked fiber waits for is ready. Dispatching it switches back to the fiber
+    class ResumeTask : public Detail::ScheduledTaskBase
+    {
+    public:
+        ResumeTask(TaskScheduler& owner, Fiber* fiber)
+            : Detail::ScheduledTaskBase(owner, 0, 0, false)
+            , mFiber(fiber)
+        {
+            mResumesFiber = true;
+        }
+
+        virtual void Dispatch() CRUNCH_OVERRIDE
+        {
+            // Only dispatched through Context::RunOnFiber()
+            CRUNCH_HALT();
+        }
+
+        virtual void Cancel() CRUNCH_OVERRIDE
+        {
+            // Never has a token. The task it resumes checks its own
+            CRUNCH_HALT();
+        }
+
+        Fiber* const mFiber;
+    };
+
+    class ReadyWaiter : public Waiter
+    {
+    public:
+        explicit ReadyWaiter(Fiber* fiber)
+            : Waiter(&Notify)
+            , mFiber(fiber)
+        {}
+
+    private:
+        static void Notify(Waiter* waiter)
+        {
+            static_cast<ReadyWaiter*>(waiter)->mFiber->mResumeTask.Enque();
+        }
+
+        Fiber* const mFiber;
+    };
+
+    Fiber(TaskScheduler& owner, std::size_t stackSize)
+        : mFiber(stackSize, &Main, this)
+        , mTask(nullptr)
+        , mResumeTask(owner, this)
+        , mReadyWaiter(this)
+    {}
+
+    // Not inlined, as a fiber may have moved to another thread since the last read
+    static __attribute__((noinline)) Context* GetCurrentContext()
+    {
+        return tContext;
+    }
+
+    Detail::Fiber mFiber;
+    Detail::ScheduledTaskBase* mTask; // Task to run when next switched to while idle
+    ResumeTask mResumeTask;
+    ReadyWaiter mReadyWaiter;
+
+private:
+    static void Main(void* argument)
+    {
+        Fiber* const fiber = static_cast<Fiber*>(argument);
+        for (;;)
+        {
+            fiber->mTask->Dispatch();
+
+            // Return to the thread the task completed on, which pools the fiber
+            Detail::SwitchFiber(fiber->mFiber.GetContext(), GetCurrentContext()->mThreadFiberContext);
+        }
+    }
+};
+
+bool TaskScheduler::Context::RunOnFiber(Detail::ScheduledTaskBase* task)
+{
+    if (task->mResumesFiber)
+    {
+        mOwner.mParkedFiberCount.Decrement(MEMORY_ORDER_RELEASE);
+        return SwitchToFiber(static_cast<Fiber::ResumeTask*>(task)->mFiber);
+    }
+
+    Fiber* fiber;
+    if (mIdleFibers.empty())
+    {
+        fiber = new Fiber(mOwner, mOwner.mConfig.fiberStackSize);
+        mCounters.fibersCreated.Increment();
+    }
+    else
+    {
+        fiber = mIdleFibers.back();
+        mIdleFibers.pop_back();
+    }
+
+    fiber->mTask = task;
+    return SwitchToFiber(fiber);
+}
+
+bool TaskScheduler::Context::SwitchToFiber(Fiber* fiber)
+{
+    for (;;)
+    {
+        mCurrentFiber = fiber;
+        Detail::SwitchFiber(mThreadFiberContext, fiber->mFiber.GetContext());
+        mCurrentFiber = nullptr;
+
+        IWaitable* const waitable = mParkWaitable;
+        if (waitable == nullptr)
+            break;
+
+        // Registered only now that the fiber has switched away, as any context may resume it once registered
+        mParkWaitable = nullptr;
+        mOwner.mParkedFiberCount.Increment(MEMORY_ORDER_RELAXED);
+        if (waitable->AddWaiter(static_cast<Waiter*>(&fiber->mReadyWaiter)))
+        {
+            mCounters.fibersParked.Increment();
+            return false;
+        }
+
+        mOwner.mParkedFiberCount.Decrement(MEMORY_ORDER_RELAXED);
+
+        // Became ready in the meantime, so carry on with the task
+    }
+
+    if (mIdleFibers.size() < mOwner.mConfig.maxIdleFibers)
+        mIdleFibers.push_back(fiber);
+    else
+        delete fiber;
+
+    return true;
+}
+
+void TaskScheduler::Context::ParkFiber(IWaitable& waitable)
+{
+    if (waitable.IsReady())
+        return;
+
+    // As when helping, a continuation handed off by the waiting task might be what it waits for
+    if (mNextTask)
+    {
+        mTasks[mNextTask->mPriority].Push(mNextTask);
+        mNextTask = nullptr;
+    }
+
+    // Resumption is dispatched like any other task, so inherit the priority and keep the token of the waiting task
+    Fiber* const fiber = mCurrentFiber;
+    fiber->mResumeTask.mPriority = mDispatchPriority;
+    CancellationToken const* const dispatchCancellation = mDispatchCancellation;
+
+    mParkWaitable = &waitable;
+    Detail::SwitchFiber(fiber->mFiber.GetContext(), mThreadFiberContext);
+
+    // Possibly resumed by another context
+    Fiber::GetCurrentContext()->mDispatchCancellation = dispatchCancellation;
+}
+
+void TaskScheduler::Context::FreeIdleFibers()
+{
+    for (auto it = mIdleFibers.begin(); it != mIdleFibers.end(); ++it)
+        delete *it;
+
+    mIdleFibers.clear();
+}
+
+#else
+
+class TaskScheduler::Fiber {};
+
+bool TaskScheduler::Context::RunOnFiber(Detail::ScheduledTaskBase* task)
+{
+    // Fibers not supported, so Config::useFibers is ignored
+    task->Dispatch();
+    return true;
+}
+
+bool TaskScheduler::Context::SwitchToFiber(Fiber*)
+{
+    return true;
+}
+
+void TaskScheduler::Context::ParkFiber(IWaitable&)
+{
+    // Never on a fiber
+    CRUNCH_HALT();
+}
+
+void TaskScheduler::Context::FreeIdleFibers()
+{}
+
+#endif
+
+TaskScheduler::Context::Context(TaskScheduler& owner, std::uint32_t processor)
     : mOwner(owner)
+    , mId(InvalidContextId)
+    , mAllocator(nullptr)
+    , mTrace(nullptr)
+    , mPopCount(0)
+    , mProcessor(processor)
+    , mProcessorInfo(owner.mTopology.Find(mProcessor))
+    , mRandom(static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(this) >> 4))
     , mContextsVersion(0)
-    , mMaxStealAttemptsBeforeIdle(20)
+    , mStealPolicy(owner.mConfig.minStealAttempts, owner.mConfig.maxStealAttempts)
+    , mMinStealAttemptsBeforeRemote(2)
     , mStealAttemptCount(0)
-{}
+    , mIsWorker(false)
+    , mNextTask(nullptr)
+    , mHandOffAllowed(false)
+    , mDispatchPriority(TASK_PRIORITY_NORMAL)
+    , mDispatchCancellation(nullptr)
+    , mMailboxTasks(nullptr)
+    , mActive(1)
+    , mLastThiefId(InvalidContextId)
+    , mCurrentFiber(nullptr)
+    , mParkWaitable(nullptr)
+{
+    std::fill(mLevelEnds, mLevelEnds + ProcessorTopology::LEVEL_COUNT, 0);
+}
 
 // TODO: exception safe dispatch (could be a per task flag, with try/catch in task dispatch implementation)
 ISchedulerContext::State TaskScheduler::Context::Run(IThrottler& throttler)
 {
     for (;;)
     {
-        // If we are not in stealing mode, run local tasks
+        // Tasks posted to this context were placed here for locality, so run them even if in stealing mode
+        if (!mMailbox.IsEmpty())
+            mStealAttemptCount = 0;
+
+        // If we are not in stealing mode, run mailbox and local tasks
         if (mStealAttemptCount == 0)
         {
             for (;;)
@@ -79,59 +711,463 @@ ISchedulerContext::State TaskScheduler::Context::Run(IThrottler& throttler)
                 if (throttler.ShouldYield())
                     return State::Working;
 
-                if (Detail::ScheduledTaskBase* task = mTasks.Pop())
-                {
-                    task->Dispatch();
-                    mRunLog.push_back(task);
-                }
+                Detail::ScheduledTaskBase* task = PopMailbox();
+                if (task == nullptr)
+                    task = PopLocal();
+
+                if (task)
+                    Dispatch(task);
                 else
                     break;
             }
         }
 
         //
-        // No more local tasks. Attempt stealing
+        // No more local tasks. Take any tasks injected from outside the scheduler
+        //
+
+        if (TakeInjectedTasks())
+        {
+            mStealAttemptCount = 0;
+            continue;
+        }
+
+        //
+        // Attempt stealing
         // 
 
         // Update neighbor config if it has changed
 
         mOwner.mContexts.ReadIfDifferent(mContextsVersion, [this] (ContextList const& contexts)
         {
-            mNeighbors.clear();
-            Context* _this = this; // Work around MSVC nested capture bug
-            std::copy_if(contexts.begin(), contexts.end(), std::back_inserter(mNeighbors), [_this] (std::shared_ptr<Context> const& p) { return p.get() != _this; });
+            UpdateNeighbors(contexts);
         });
 
         // If nowhere to steal from, return idle
         if (mNeighbors.empty())
-            return State::Idle;
+            return EnterIdle();
 
-        // Select neighbor and steal
-        // TODO: fast random number generator
-        // TODO: steal local first
-        int stealIndex = rand() % mNeighbors.size();
-        if (Detail::ScheduledTaskBase* task = mNeighbors[stealIndex]->mTasks.Steal())
+        if (Detail::ScheduledTaskBase* task = Steal())
         {
+            // Let idle contexts help with any other stolen tasks
+            if (!IsLocalEmpty())
+                mOwner.NotifyWorkAvailable();
+
+            if (mStealPolicy.IsIdle())
+                mStealPolicy.OnWorkFound(GetTimestampNanoseconds());
+
             mStealAttemptCount = 0;
-            task->Dispatch();
-            mRunLog.push_back(task);
+            Dispatch(task);
         }
         else
         {
-            if (++mStealAttemptCount > mMaxStealAttemptsBeforeIdle)
+            if (++mStealAttemptCount > mStealPolicy.GetAttemptBudget())
+                return EnterIdle();
+            else
             {
-                // Meta scheduler will not call back in until mOwner.mWorkAvailable is posted.
-                // It will only be posted if mOwner.mIdleCount > 0
-                // mOwner.mIdleCount is incremented at the same time as mWorkAvailable is posted, so no need to change on entry to Run
-                mOwner.mIdleCount.Increment();
-                return State::Idle;
+                for (std::uint32_t i = mStealPolicy.GetBackoff(mStealAttemptCount); i != 0; --i)
+                    Detail::CpuPause();
+
+                mCounters.pollingTransitions.Increment();
+                return State::Polling;
             }
+        }
+    }
+}
+
+bool TaskScheduler::Context::TakeInjectedTasks()
+{
+    Detail::ScheduledTaskBase* injected = mOwner.mInjectedTasks.PopAll();
+    if (injected == nullptr)
+        return false;
+
+    // List is most recent first. Pushing in list order leaves the oldest task on top to run first,
+    // while the rest remain available for stealing by other contexts
+    do
+    {
+        Detail::ScheduledTaskBase* next = Detail::GetNext(*injected);
+        mTasks[injected->mPriority].Push(injected);
+        mCounters.tasksInjected.Increment();
+        injected = next;
+    }
+    while (injected);
+
+    // Let idle contexts help with the batch
+    if (!IsLocalEmpty())
+        mOwner.NotifyWorkAvailable();
+
+    if (mStealPolicy.IsIdle())
+        mStealPolicy.OnWorkFound(GetTimestampNanoseconds());
+
+    return true;
+}
+
+void TaskScheduler::Context::WaitFor(IWaitable& waitable)
+{
+    if (mCurrentFiber)
+    {
+        ParkFiber(waitable);
+        return;
+    }
+
+    // A continuation handed off by the calling task might be what it waits for, so make it runnable
+    if (mNextTask)
+    {
+        mTasks[mNextTask->mPriority].Push(mNextTask);
+        mNextTask = nullptr;
+    }
+
+    // Tasks run while waiting are dispatched as from Run(). Restore the state of the waiting task's dispatch afterwards
+    bool const handOffAllowed = mHandOffAllowed;
+    TaskPriority const dispatchPriority = mDispatchPriority;
+    CancellationToken const* const dispatchCancellation = mDispatchCancellation;
+    std::uint32_t const stealAttemptCount = mStealAttemptCount;
+
+    mStealAttemptCount = 0;
+    while (!waitable.IsReady())
+    {
+        Detail::ScheduledTaskBase* task = PopMailbox();
+        if (task == nullptr)
+            task = PopLocal();
+
+        if (task == nullptr && TakeInjectedTasks())
+            task = PopLocal();
+
+        if (task == nullptr)
+            task = StealForWait();
+
+        if (task)
+        {
+            mStealAttemptCount = 0;
+            mCounters.tasksHelped.Increment();
+            Dispatch(task);
+        }
+        else if (++mStealAttemptCount > mStealPolicy.GetAttemptBudget())
+        {
+            ParkUntilReady(waitable);
+            mStealAttemptCount = 0;
+        }
+        else
+        {
+            for (std::uint32_t i = mStealPolicy.GetBackoff(mStealAttemptCount); i != 0; --i)
+                Detail::CpuPause();
+        }
+    }
+
+    mHandOffAllowed = handOffAllowed;
+    mDispatchPriority = dispatchPriority;
+    mDispatchCancellation = dispatchCancellation;
+    mStealAttemptCount = stealAttemptCount;
+}
+
+Detail::ScheduledTaskBase* TaskScheduler::Context::StealForWait()
+{
+    mOwner.mContexts.ReadIfDifferent(mContextsVersion, [this] (ContextList const& contexts)
+    {
+        UpdateNeighbors(contexts);
+    });
+
+    // Leapfrogging. The awaited task was most likely taken by the last thief, in which case the tasks it has queued
+    // are the ones leading to its completion. Helping with those keeps the wait short, and avoids nesting unrelated
+    // long running tasks on this stack
+    std::uint32_t const thiefId = mLastThiefId.Load(MEMORY_ORDER_RELAXED);
+    if (thiefId != InvalidContextId)
+    {
+        for (auto it = mNeighbors.begin(); it != mNeighbors.end(); ++it)
+        {
+            if ((*it)->mId != thiefId)
+                continue;
+
+            mCounters.stealAttempts.Increment();
+            if (Detail::ScheduledTaskBase* task = StealHalfFrom(**it))
+            {
+                (*it)->mLastThiefId.Store(mId, MEMORY_ORDER_RELAXED);
+                mCounters.stealSuccesses.Increment();
+                return task;
+            }
+
+            break;
+        }
+    }
+
+    return mNeighbors.empty() ? nullptr : Steal();
+}
+
+void TaskScheduler::Context::ParkUntilReady(IWaitable& waitable)
+{
+    // Park on the worker event, so the context wakes up both for new work and for the waitable becoming ready.
+    // Waking all is needed as parked workers share the event, and they go back to sleep if there is nothing for them
+    WakeWaiter waiter(mOwner.mWorkerEvent);
+    if (!waitable.AddWaiter(static_cast<Waiter*>(&waiter)))
+        return;
+
+    EventCount::Key const key = mOwner.mWorkerEvent.PrepareWait();
+    if (waiter.IsDone() || !IsLocalEmpty() || HasStealableWork())
+        mOwner.mWorkerEvent.CancelWait();
+    else
+    {
+        CRUNCH_CONCURRENCY_TASKS_TRACE(mTrace, Detail::TRACE_EVENT_PARK, 0);
+        mCounters.workerParks.Increment();
+        mOwner.mWorkerEvent.Wait(key);
+        CRUNCH_CONCURRENCY_TASKS_TRACE(mTrace, Detail::TRACE_EVENT_UNPARK, 0);
+    }
+
+    // Failing to remove means the waiter is being notified, and must stay alive until it is done
+    if (!waitable.RemoveWaiter(&waiter))
+        while (!waiter.IsDone())
+            Detail::CpuPause();
+}
+
+Detail::ScheduledTaskBase* TaskScheduler::Context::PopLocal()
+{
+    if (++mPopCount % StarvationInterval == 0)
+    {
+        for (std::uint32_t level = TASK_PRIORITY_COUNT; level-- != 0;)
+            if (!mTasks[level].IsEmpty())
+                if (Detail::ScheduledTaskBase* task = mTasks[level].Pop())
+                    return task;
+    }
+    else
+    {
+        for (std::uint32_t level = 0; level < TASK_PRIORITY_COUNT; ++level)
+            if (!mTasks[level].IsEmpty())
+                if (Detail::ScheduledTaskBase* task = mTasks[level].Pop())
+                    return task;
+    }
+
+    return nullptr;
+}
+
+void TaskScheduler::Context::Post(Detail::ScheduledTaskBase* task)
+{
+    mMailbox.Push(task);
+
+    // Pairs with the fence in TaskScheduler::Leave()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mActive.Load(MEMORY_ORDER_RELAXED) == 0)
+        mOwner.InjectTasks(mMailbox.PopAll());
+    else
+        mOwner.NotifyWorkAvailable();
+}
+
+Detail::ScheduledTaskBase* TaskScheduler::Context::PopMailbox()
+{
+    if (mMailboxTasks == nullptr)
+    {
+        Detail::ScheduledTaskBase* posted = mMailbox.PopAll();
+        if (posted == nullptr)
+            return nullptr;
+
+        // List is most recent first. Reverse to run in the order posted
+        do
+        {
+            Detail::ScheduledTaskBase* next = Detail::GetNext(*posted);
+            Detail::SetNext(*posted, mMailboxTasks);
+            mMailboxTasks = posted;
+            posted = next;
+        }
+        while (posted);
+
+        if (mStealPolicy.IsIdle())
+            mStealPolicy.OnWorkFound(GetTimestampNanoseconds());
+    }
+
+    Detail::ScheduledTaskBase* task = mMailboxTasks;
+    mMailboxTasks = Detail::GetNext(*task);
+    mCounters.tasksFromMailbox.Increment();
+    return task;
+}
+
+Detail::ScheduledTaskBase* TaskScheduler::Context::TakeMailboxFrom(Context& victim)
+{
+    Detail::ScheduledTaskBase* posted = victim.mMailbox.PopAll();
+    if (posted == nullptr)
+        return nullptr;
+
+    // As with injected tasks, pushing in list order leaves the oldest task on top, and the rest available for stealing
+    do
+    {
+        Detail::ScheduledTaskBase* next = Detail::GetNext(*posted);
+        mTasks[posted->mPriority].Push(posted);
+        posted = next;
+    }
+    while (posted);
+
+    return PopLocal();
+}
+
+Detail::ScheduledTaskBase* TaskScheduler::Context::StealHalfFrom(Context& victim)
+{
+    // Take from the highest priority level with work, into the same level locally
+    for (std::uint32_t level = 0; level < TASK_PRIORITY_COUNT; ++level)
+        if (!victim.mTasks[level].IsEmpty())
+            return victim.mTasks[level].StealHalf(mTasks[level]);
+
+    return nullptr;
+}
+
+void TaskScheduler::Context::Dispatch(Detail::ScheduledTaskBase* task)
+{
+    // Beyond the max chain length, continuations are queued to give the throttler and queued tasks a chance to run
+    for (std::uint32_t chainLength = 1; task != nullptr; ++chainLength)
+    {
+        mHandOffAllowed = chainLength < MaxHandOffChainLength;
+        mDispatchPriority = task->mPriority;
+
+        // Cancelled tasks are dropped without running, which also drops anything they would have spawned
+        if (task->mCancellation.IsCancelled())
+        {
+            task->Cancel();
+            mCounters.tasksCancelled.Increment();
+        }
+        else
+        {
+            mDispatchCancellation = task->mCancellation.IsSet() ? &task->mCancellation : nullptr;
+            CRUNCH_CONCURRENCY_TASKS_TRACE(mTrace, Detail::TRACE_EVENT_DISPATCH_BEGIN, reinterpret_cast<std::uintptr_t>(task));
+            bool completed = true;
+            if (mOwner.mConfig.useFibers && mCurrentFiber == nullptr)
+                completed = RunOnFiber(task);
             else
+                task->Dispatch();
+            CRUNCH_CONCURRENCY_TASKS_TRACE(mTrace, Detail::TRACE_EVENT_DISPATCH_END, 0);
+            mDispatchCancellation = nullptr;
+
+            // A parked task is counted once, when its fiber is resumed and completes it
+            if (completed)
+                mCounters.tasksExecuted.Increment();
+            if (chainLength > 1)
+                mCounters.tasksHandedOff.Increment();
+        }
+
+        task = mNextTask;
+        mNextTask = nullptr;
+    }
+
+    mHandOffAllowed = false;
+}
+
+void TaskScheduler::Context::AddStatistics(Statistics& statistics) const
+{
+    statistics.tasksExecuted += mCounters.tasksExecuted.Get();
+    statistics.tasksHandedOff += mCounters.tasksHandedOff.Get();
+    statistics.tasksInjected += mCounters.tasksInjected.Get();
+    statistics.tasksFromMailbox += mCounters.tasksFromMailbox.Get();
+    statistics.tasksCancelled += mCounters.tasksCancelled.Get();
+    statistics.tasksHelped += mCounters.tasksHelped.Get();
+    statistics.stealAttempts += mCounters.stealAttempts.Get();
+    statistics.stealSuccesses += mCounters.stealSuccesses.Get();
+    for (std::uint32_t level = 0; level < ProcessorTopology::LEVEL_COUNT; ++level)
+        statistics.stealAttemptsByLevel[level] += mCounters.stealAttemptsByLevel[level].Get();
+    statistics.pollingTransitions += mCounters.pollingTransitions.Get();
+    statistics.idleTransitions += mCounters.idleTransitions.Get();
+    statistics.workerParks += mCounters.workerParks.Get();
+    statistics.fibersCreated += mCounters.fibersCreated.Get();
+    statistics.fibersParked += mCounters.fibersParked.Get();
+
+    for (std::uint32_t level = 0; level < TASK_PRIORITY_COUNT; ++level)
+    {
+        WorkStealingTaskQueue::Statistics const queueStatistics = mTasks[level].GetStatistics();
+        statistics.queueGrowCount += queueStatistics.growCount;
+        statistics.queueShrinkCount += queueStatistics.shrinkCount;
+        statistics.queueHighWaterMark = std::max(statistics.queueHighWaterMark, queueStatistics.highWaterMark);
+    }
+}
+
+void TaskScheduler::Context::UpdateNeighbors(ContextList const& contexts)
+{
+    mNeighbors.clear();
+    Context* _this = this; // Work around MSVC nested capture bug
+    std::copy_if(contexts.begin(), contexts.end(), std::back_inserter(mNeighbors), [_this] (std::shared_ptr<Context> const& p) { return p.get() != _this; });
+
+    // Group neighbors by the closest resource shared with this context
+    ProcessorInfo const* processorInfo = mProcessorInfo;
+    auto getLevel = [processorInfo] (std::shared_ptr<Context> const& p) { return ProcessorTopology::GetSharedLevel(processorInfo, p->mProcessorInfo); };
+    std::stable_sort(mNeighbors.begin(), mNeighbors.end(), [&] (std::shared_ptr<Context> const& a, std::shared_ptr<Context> const& b) { return getLevel(a) < getLevel(b); });
+
+    std::uint32_t index = 0;
+    for (std::uint32_t level = 0; level < ProcessorTopology::LEVEL_COUNT; ++level)
+    {
+        while (index < mNeighbors.size() && getLevel(mNeighbors[index]) == level)
+            ++index;
+
+        mLevelEnds[level] = index;
+    }
+}
+
+Detail::ScheduledTaskBase* TaskScheduler::Context::Steal()
+{
+    // Try a random neighbor at each level, closest first.
+    // Remote neighbors are only tried after failing to find work closer by, as stealing across nodes is expensive
+    std::uint32_t const maxLevel = mStealAttemptCount < mMinStealAttemptsBeforeRemote ? ProcessorTopology::LEVEL_NODE : ProcessorTopology::LEVEL_REMOTE;
+
+    std::uint32_t levelBegin = 0;
+    for (std::uint32_t level = 0; level <= maxLevel; ++level)
+    {
+        std::uint32_t const levelEnd = mLevelEnds[level];
+        if (levelEnd != levelBegin)
+        {
+            // Steal half of the victim's tasks so a single successful steal rebalances a whole burst of work
+            Context& victim = *mNeighbors[levelBegin + mRandom.Next(levelEnd - levelBegin)];
+            CRUNCH_CONCURRENCY_TASKS_TRACE(mTrace, Detail::TRACE_EVENT_STEAL_ATTEMPT, reinterpret_cast<std::uintptr_t>(&victim));
+            Detail::ScheduledTaskBase* task = StealHalfFrom(victim);
+
+            // Tasks posted to the victim are left for it while it might get to them, so only taken after failing to steal before
+            if (task == nullptr && mStealAttemptCount != 0)
+                task = TakeMailboxFrom(victim);
+
+            mStealPolicy.OnStealAttempt(task != nullptr);
+            mCounters.stealAttempts.Increment();
+            mCounters.stealAttemptsByLevel[level].Increment();
+            if (task)
             {
-                return State::Polling;
+                // Contexts waiting on a task stolen from here look for work leading to it with the thief
+                if (victim.mLastThiefId.Load(MEMORY_ORDER_RELAXED) != mId)
+                    victim.mLastThiefId.Store(mId, MEMORY_ORDER_RELAXED);
+
+                mCounters.stealSuccesses.Increment();
+                CRUNCH_CONCURRENCY_TASKS_TRACE(mTrace, Detail::TRACE_EVENT_STEAL_SUCCESS, reinterpret_cast<std::uintptr_t>(task));
+                return task;
             }
         }
+
+        levelBegin = levelEnd;
     }
+
+    return nullptr;
+}
+
+bool TaskScheduler::Context::HasStealableWork() const
+{
+    if (!mOwner.mInjectedTasks.IsEmpty() || !mMailbox.IsEmpty())
+        return true;
+
+    for (auto it = mNeighbors.begin(); it != mNeighbors.end(); ++it)
+        if (!(*it)->IsLocalEmpty() || !(*it)->mMailbox.IsEmpty())
+            return true;
+
+    return false;
+}
+
+ISchedulerContext::State TaskScheduler::Context::EnterIdle()
+{
+    mStealAttemptCount = 0;
+    mStealPolicy.OnIdle(GetTimestampNanoseconds());
+    mCounters.idleTransitions.Increment();
+
+    // Workers spin and park in TaskScheduler::ParkWorker()
+    if (mIsWorker)
+        return State::Idle;
+
+    // Meta scheduler will not call back in until mOwner.mWorkAvailable is posted.
+    // It will only be posted if mOwner.mIdleCount > 0
+    // mOwner.mIdleCount is decremented at the same time as mWorkAvailable is posted, so no need to change on entry to Run
+    mOwner.mIdleCount.Increment();
+
+    // Work made available before the idle count became visible to producers will not trigger a wake up, so check again
+    if (HasStealableWork())
+        mOwner.WakeIdleContext();
+
+    return State::Idle;
 }
 
 IWaitable& TaskScheduler::Context::GetHasWorkCondition()
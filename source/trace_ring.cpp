@@ -0,0 +1,117 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/detail/trace_ring.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <ostream>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+void TraceRing::CopyEvents(std::vector<TraceEvent>& events) const
+{
+    std::uint64_t const capacity = mMask + 1;
+    std::uint64_t const head = mHead.Load(MEMORY_ORDER_ACQUIRE);
+    std::uint64_t const begin = head > capacity ? head - capacity : 0;
+
+    std::size_t const firstCopied = events.size();
+    for (std::uint64_t i = begin; i < head; ++i)
+    {
+        Slot const& slot = mSlots[i & mMask];
+        TraceEvent event;
+        event.timestamp = slot.timestamp.Load(MEMORY_ORDER_RELAXED);
+        event.argument = slot.argument.Load(MEMORY_ORDER_RELAXED);
+        event.type = static_cast<TraceEventType>(slot.type.Load(MEMORY_ORDER_RELAXED));
+        events.push_back(event);
+    }
+
+    // Discard events the writer might have overwritten while copying, including a slot being written right now
+    std::atomic_thread_fence(std::memory_order_acquire);
+    std::uint64_t const newHead = mHead.Load(MEMORY_ORDER_RELAXED);
+    std::uint64_t const validBegin = newHead + 1 > capacity ? newHead + 1 - capacity : 0;
+    if (validBegin > begin)
+    {
+        std::size_t const discardCount = static_cast<std::size_t>(std::min(validBegin - begin, head - begin));
+        events.erase(events.begin() + firstCopied, events.begin() + firstCopied + discardCount);
+    }
+}
+
+namespace
+{
+    char const* GetEventName(TraceEventType type)
+    {
+        switch (type)
+        {
+        case TRACE_EVENT_SPAWN: return "Spawn";
+        case TRACE_EVENT_DISPATCH_BEGIN:
+        case TRACE_EVENT_DISPATCH_END: return "Task";
+        case TRACE_EVENT_STEAL_ATTEMPT: return "Steal attempt";
+        case TRACE_EVENT_STEAL_SUCCESS: return "Steal";
+        case TRACE_EVENT_PARK:
+        case TRACE_EVENT_UNPARK: return "Parked";
+        }
+
+        return "Unknown";
+    }
+
+    char const* GetEventPhase(TraceEventType type)
+    {
+        switch (type)
+        {
+        case TRACE_EVENT_DISPATCH_BEGIN:
+        case TRACE_EVENT_PARK: return "B";
+        case TRACE_EVENT_DISPATCH_END:
+        case TRACE_EVENT_UNPARK: return "E";
+        default: return "i";
+        }
+    }
+
+    char const* GetArgumentName(TraceEventType type)
+    {
+        return type == TRACE_EVENT_STEAL_ATTEMPT ? "victim" : "task";
+    }
+}
+
+void WriteChromeTrace(std::ostream& stream, std::vector<TraceRing const*> const& rings)
+{
+    std::vector<std::vector<TraceEvent>> ringEvents(rings.size());
+    std::uint64_t baseTimestamp = std::numeric_limits<std::uint64_t>::max();
+    for (std::size_t i = 0; i < rings.size(); ++i)
+    {
+        rings[i]->CopyEvents(ringEvents[i]);
+        if (!ringEvents[i].empty())
+            baseTimestamp = std::min(baseTimestamp, ringEvents[i].front().timestamp);
+    }
+
+    stream << "{\"traceEvents\":[";
+
+    char const* separator = "\n";
+    for (std::size_t i = 0; i < rings.size(); ++i)
+    {
+        std::uint32_t const tid = rings[i]->GetId();
+        stream << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid
+               << ",\"args\":{\"name\":\"Context " << tid << "\"}}";
+        separator = ",\n";
+
+        for (auto it = ringEvents[i].begin(); it != ringEvents[i].end(); ++it)
+        {
+            // Timestamps are in microseconds
+            char ts[32];
+            std::snprintf(ts, sizeof(ts), "%.3f", double(it->timestamp - baseTimestamp) / 1000);
+
+            stream << separator << "{\"name\":\"" << GetEventName(it->type) << "\",\"ph\":\"" << GetEventPhase(it->type) << "\"";
+            if (GetEventPhase(it->type)[0] == 'i')
+                stream << ",\"s\":\"t\"";
+            stream << ",\"ts\":" << ts << ",\"pid\":0,\"tid\":" << tid;
+            if (it->argument != 0)
+                stream << ",\"args\":{\"" << GetArgumentName(it->type) << "\":\"0x" << std::hex << it->argument << std::dec << "\"}";
+            stream << "}";
+        }
+    }
+
+    stream << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+}}}
@@ -0,0 +1,72 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/detail/adaptive_steal_policy.hpp"
+#include "crunch/test/framework.hpp"
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+BOOST_AUTO_TEST_SUITE(AdaptiveStealPolicyTests)
+
+BOOST_AUTO_TEST_CASE(AttemptBudgetTest)
+{
+    AdaptiveStealPolicy policy(4, 64);
+    std::uint32_t const initialBudget = policy.GetAttemptBudget();
+    BOOST_CHECK(initialBudget >= 4 && initialBudget <= 64);
+
+    // Work arriving shortly after going idle grows the budget up to the max
+    std::uint64_t now = 1;
+    for (int i = 0; i < 10; ++i)
+    {
+        policy.OnIdle(now);
+        BOOST_CHECK(policy.IsIdle());
+        now += AdaptiveStealPolicy::ShortIdleNanoseconds / 2;
+        policy.OnWorkFound(now);
+        BOOST_CHECK(!policy.IsIdle());
+    }
+
+    BOOST_CHECK_EQUAL(policy.GetAttemptBudget(), 64u);
+
+    // Long idle periods shrink the budget down to the min
+    for (int i = 0; i < 10; ++i)
+    {
+        policy.OnIdle(now);
+        now += AdaptiveStealPolicy::LongIdleNanoseconds * 2;
+        policy.OnWorkFound(now);
+    }
+
+    BOOST_CHECK_EQUAL(policy.GetAttemptBudget(), 4u);
+    BOOST_CHECK(policy.GetMeanIdleNanoseconds() > AdaptiveStealPolicy::LongIdleNanoseconds);
+
+    // Repeated idle without finding work counts from the first
+    policy.OnIdle(now);
+    policy.OnIdle(now + AdaptiveStealPolicy::LongIdleNanoseconds * 2);
+    policy.OnWorkFound(now + AdaptiveStealPolicy::LongIdleNanoseconds * 2 + 1);
+    BOOST_CHECK_EQUAL(policy.GetAttemptBudget(), 4u);
+}
+
+BOOST_AUTO_TEST_CASE(BackoffTest)
+{
+    AdaptiveStealPolicy policy(4, 64);
+
+    // Failing steals increase the backoff limit
+    for (int i = 0; i < 200; ++i)
+        policy.OnStealAttempt(false);
+
+    std::uint32_t const failingLimit = policy.GetBackoffLimit();
+    BOOST_CHECK(failingLimit > AdaptiveStealPolicy::MaxBackoff / 2);
+    BOOST_CHECK_EQUAL(policy.GetBackoff(0), 0u);
+    BOOST_CHECK_EQUAL(policy.GetBackoff(2), 3u);
+    BOOST_CHECK_EQUAL(policy.GetBackoff(100), failingLimit);
+
+    // Succeeding steals retry eagerly
+    for (int i = 0; i < 200; ++i)
+        policy.OnStealAttempt(true);
+
+    BOOST_CHECK(policy.GetBackoffLimit() < 8);
+    BOOST_CHECK(policy.GetSuccessRate() > AdaptiveStealPolicy::RateOne * 9 / 10);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}}
@@ -0,0 +1,120 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/coroutine.hpp"
+
+#if defined (CRUNCH_CONCURRENCY_HAS_COROUTINES)
+
+#include <boost/test/test_tools.hpp>
+#include <boost/test/unit_test_suite.hpp>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(CoroutineTests)
+
+namespace
+{
+    Coroutine<int> Double(TaskScheduler& scheduler, int x)
+    {
+        int const value = co_await scheduler.Add([=] { return x; });
+        co_return value * 2;
+    }
+
+    Coroutine<int> Sum(TaskScheduler& scheduler, int x)
+    {
+        Future<int> first = scheduler.Add([=] { return x; });
+        int const a = co_await first;
+        int const b = co_await Double(scheduler, x);
+
+        // Ready futures continue without suspending
+        BOOST_CHECK(first.IsReady());
+        int const c = co_await first;
+
+        co_return a + b + c;
+    }
+
+    struct DestructionCounter
+    {
+        explicit DestructionCounter(int& count) : count(count) {}
+        ~DestructionCounter() { count++; }
+        int& count;
+    };
+
+    Coroutine<int> CancelWhileSuspended(TaskScheduler& scheduler, CancellationToken cancellation, int& destroyedCount, bool& resumed)
+    {
+        DestructionCounter counter(destroyedCount);
+        co_await scheduler.Add([&cancellation] { cancellation.Cancel(); });
+        resumed = true;
+        co_return 1;
+    }
+
+    Coroutine<int> Fib(TaskScheduler& scheduler, int n)
+    {
+        if (n < 2)
+            co_return n;
+
+        Future<int> a = scheduler.Add([&scheduler, n] { return Fib(scheduler, n - 1); });
+        int const b = co_await Fib(scheduler, n - 2);
+        co_return co_await a + b;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RunTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    Future<int> result = scheduler.Add([&] { return Sum(scheduler, 3); });
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK_EQUAL(result.Get(), 3 + 6 + 3);
+    BOOST_CHECK(!IsCancelled(result));
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(CancellationTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // The awaited task cancels the token, so the coroutine is destroyed instead of resumed
+    int destroyedCount = 0;
+    bool resumed = false;
+    CancellationToken cancellation = CancellationToken::Create();
+    Future<int> result = scheduler.Add([&] { return CancelWhileSuspended(scheduler, cancellation, destroyedCount, resumed); }, cancellation);
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK(IsCancelled(result));
+    BOOST_CHECK_EQUAL(result.Get(), 0);
+    BOOST_CHECK(!resumed);
+    BOOST_CHECK_EQUAL(destroyedCount, 1);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 2;
+    TaskScheduler scheduler(config);
+
+    for (int i = 0; i < 20; ++i)
+    {
+        Future<int> result = scheduler.Add([&scheduler] { return Fib(scheduler, 15); });
+        scheduler.WaitFor(result);
+        BOOST_CHECK_EQUAL(result.Get(), 610);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
+
+#endif
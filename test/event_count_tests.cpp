@@ -0,0 +1,91 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/event_count.hpp"
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/concurrency/thread.hpp"
+#include "crunch/test/framework.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(EventCountTests)
+
+BOOST_AUTO_TEST_CASE(CancelWaitTest)
+{
+    EventCount ec;
+    BOOST_CHECK_EQUAL(ec.GetWaiterCount(), 0u);
+
+    EventCount::Key const key = ec.PrepareWait();
+    BOOST_CHECK_EQUAL(ec.GetWaiterCount(), 1u);
+    ec.CancelWait();
+    BOOST_CHECK_EQUAL(ec.GetWaiterCount(), 0u);
+
+    // Notification after PrepareWait() makes Wait() return immediately
+    EventCount::Key const key2 = ec.PrepareWait();
+    BOOST_CHECK_EQUAL(key, key2);
+    ec.NotifyOne();
+    ec.Wait(key2);
+    BOOST_CHECK_EQUAL(ec.GetWaiterCount(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(ProducerConsumerTest)
+{
+    // Consumers park until all items are consumed. No notification must be lost
+    EventCount ec;
+    Atomic<std::uint32_t> available(0);
+    Atomic<std::uint32_t> consumed(0);
+    std::uint32_t const itemCount = 100000;
+    int const consumerCount = 3;
+
+    auto tryConsume = [&] () -> bool {
+        std::uint32_t count = available.Load();
+        while (count != 0)
+        {
+            if (available.CompareAndSwap(count, count - 1))
+            {
+                consumed.Increment();
+                return true;
+            }
+            count = available.Load();
+        }
+        return false;
+    };
+
+    std::vector<std::shared_ptr<Thread>> consumers;
+    for (int i = 0; i < consumerCount; ++i)
+    {
+        consumers.push_back(std::make_shared<Thread>([&] {
+            while (consumed.Load() != itemCount)
+            {
+                if (tryConsume())
+                    continue;
+
+                EventCount::Key const key = ec.PrepareWait();
+                if (available.Load() != 0 || consumed.Load() == itemCount)
+                    ec.CancelWait();
+                else
+                    ec.Wait(key);
+            }
+            ec.NotifyAll();
+        }));
+    }
+
+    for (std::uint32_t i = 0; i < itemCount; ++i)
+    {
+        available.Increment();
+        ec.NotifyOne();
+    }
+
+    for (int i = 0; i < consumerCount; ++i)
+        consumers[i]->Join();
+
+    BOOST_CHECK_EQUAL(consumed.Load(), itemCount);
+    BOOST_CHECK_EQUAL(ec.GetWaiterCount(), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
@@ -0,0 +1,133 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/task_scheduler.hpp"
+
+#if defined (CRUNCH_CONCURRENCY_HAS_FIBERS)
+
+#include "waiting_tasks.hpp"
+
+#include <boost/test/test_tools.hpp>
+#include <boost/test/unit_test_suite.hpp>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(FiberTests)
+
+namespace
+{
+    struct PingPong
+    {
+        Detail::FiberContext thread;
+        Detail::Fiber* fiber;
+        int count;
+    };
+
+    void PingPongMain(void* argument)
+    {
+        PingPong& state = *static_cast<PingPong*>(argument);
+        for (;;)
+        {
+            // Locals on the fiber stack survive switches
+            int const before = state.count;
+            state.count++;
+            Detail::SwitchFiber(state.fiber->GetContext(), state.thread);
+            BOOST_CHECK_EQUAL(state.count, before + 2);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SwitchTest)
+{
+    PingPong state;
+    state.count = 0;
+    Detail::Fiber fiber(16 * 1024, &PingPongMain, &state);
+    state.fiber = &fiber;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        Detail::SwitchFiber(state.thread, fiber.GetContext());
+        BOOST_CHECK_EQUAL(state.count, 2 * i + 1);
+        state.count++;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ParkTest)
+{
+    TaskScheduler::Config config;
+    config.useFibers = true;
+    TaskScheduler scheduler(config);
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // The waiting task parks its fiber, and the context runs the child on another
+    int result = 0;
+    Future<void> root = scheduler.Add([&]
+    {
+        Future<int> child = scheduler.Add([] { return 42; });
+        scheduler.WaitFor(child);
+        BOOST_CHECK(child.IsReady());
+        result = child.Get();
+    });
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK(root.IsReady());
+    BOOST_CHECK_EQUAL(result, 42);
+
+    TaskScheduler::Statistics statistics = scheduler.GetStatistics();
+    BOOST_CHECK_EQUAL(statistics.fibersParked, 1u);
+    BOOST_CHECK_EQUAL(statistics.fibersCreated, 2u);
+    BOOST_CHECK_EQUAL(statistics.tasksHelped, 0u);
+
+    // The parked task is counted once, when it completes, and its resumption not at all
+    BOOST_CHECK_EQUAL(statistics.tasksExecuted, 2u);
+
+    // Idle fibers are reused
+    Future<int> value = scheduler.Add([] { return 7; });
+    scheduler.GetContext().Run(throttler);
+    BOOST_CHECK_EQUAL(value.Get(), 7);
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().fibersCreated, 2u);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(ChainTest)
+{
+    TaskScheduler::Config config;
+    config.useFibers = true;
+    config.fiberStackSize = 16 * 1024;
+    TaskScheduler scheduler(config);
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // Each task waits on the next. Parked fibers keep the thread's stack from growing with the chain
+    int const depth = 500;
+    Future<int> result = scheduler.Add([&] { return Test::WaitingChain(scheduler, depth); });
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK_EQUAL(result.Get(), depth);
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().fibersParked, static_cast<std::uint64_t>(depth));
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksExecuted, static_cast<std::uint64_t>(depth + 1));
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(StressTest)
+{
+    // Parked tasks resume on whichever context dispatches their resume task
+    TaskScheduler::Config config;
+    config.workerCount = 2;
+    config.useFibers = true;
+    TaskScheduler scheduler(config);
+
+    Test::CheckWaitingFib(scheduler);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
+
+#endif
@@ -0,0 +1,104 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/injection_queue.hpp"
+#include "crunch/concurrency/thread.hpp"
+#include "crunch/test/framework.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+namespace
+{
+    struct Node
+    {
+        Node() : next(nullptr), value(0) {}
+
+        Node* next;
+        int value;
+    };
+
+    void SetNext(Node& node, Node* next)
+    {
+        node.next = next;
+    }
+
+    Node* GetNext(Node& node)
+    {
+        return node.next;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(InjectionQueueTests)
+
+BOOST_AUTO_TEST_CASE(BasicOperationsTest)
+{
+    InjectionQueue<Node> queue;
+    Node nodes[3];
+
+    BOOST_CHECK(queue.IsEmpty());
+    BOOST_CHECK_EQUAL(queue.PopAll(), (Node*)0);
+
+    // PopAll returns most recent first
+    queue.Push(nodes);
+    queue.Push(nodes + 1);
+    queue.Push(nodes + 2);
+    BOOST_CHECK(!queue.IsEmpty());
+
+    Node* list = queue.PopAll();
+    BOOST_CHECK(queue.IsEmpty());
+    BOOST_CHECK_EQUAL(list, nodes + 2);
+    BOOST_CHECK_EQUAL(GetNext(*list), nodes + 1);
+    BOOST_CHECK_EQUAL(GetNext(*GetNext(*list)), nodes);
+    BOOST_CHECK_EQUAL(GetNext(*GetNext(*GetNext(*list))), (Node*)0);
+}
+
+BOOST_AUTO_TEST_CASE(MultiProducerTest)
+{
+    int const producerCount = 4;
+    int const pushCount = 10000;
+
+    InjectionQueue<Node> queue;
+    std::vector<Node> nodes(producerCount * pushCount);
+
+    std::vector<std::shared_ptr<Thread>> producers;
+    for (int p = 0; p < producerCount; ++p)
+    {
+        producers.push_back(std::make_shared<Thread>([&, p] {
+            for (int i = 0; i < pushCount; ++i)
+            {
+                Node& node = nodes[p * pushCount + i];
+                node.value = p;
+                queue.Push(&node);
+            }
+        }));
+    }
+
+    // Consume concurrently with producers, checking per producer ordering is preserved (most recent first)
+    int popped = 0;
+    while (popped < producerCount * pushCount)
+    {
+        Node* node = queue.PopAll();
+        Node* last[producerCount] = {};
+        while (node)
+        {
+            if (last[node->value])
+                BOOST_CHECK(node < last[node->value]);
+            last[node->value] = node;
+            popped++;
+            node = GetNext(*node);
+        }
+    }
+
+    for (std::size_t p = 0; p < producers.size(); ++p)
+        producers[p]->Join();
+
+    BOOST_CHECK_EQUAL(popped, producerCount * pushCount);
+    BOOST_CHECK(queue.IsEmpty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
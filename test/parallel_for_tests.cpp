@@ -1,13 +1,17 @@
 // Copyright (c) 2011, Christian Rorvik
 // Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
 
+#include "crunch/concurrency/atomic.hpp"
 #include "crunch/concurrency/index_range.hpp"
 #include "crunch/concurrency/parallel_for.hpp"
+#include "crunch/concurrency/thread.hpp"
+#include "crunch/concurrency/yield.hpp"
 
 #include <boost/test/test_tools.hpp>
 #include <boost/test/unit_test_suite.hpp>
 
 #include <algorithm>
+#include <memory>
 #include <vector>
 
 namespace Crunch { namespace Concurrency {
@@ -46,6 +50,416 @@ BOOST_AUTO_TEST_CASE(RunTest)
     scheduler.Leave();
 }
 
+BOOST_AUTO_TEST_CASE(CancellationTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // Cancel from the first leaf. Sub-ranges still queued are dropped
+    std::size_t const size = 1024;
+    std::size_t processed = 0;
+    CancellationToken cancellation = CancellationToken::Create();
+    Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+        processed += r.Size();
+        cancellation.Cancel();
+    }, cancellation);
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK(IsCancelled(result));
+    BOOST_CHECK_EQUAL(processed, 1u);
+    BOOST_CHECK(scheduler.GetStatistics().tasksCancelled > 0);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(InheritedCancellationTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // Tasks skipped through the token of the calling task still count towards completion of the invocation
+    std::size_t const size = 1024;
+    std::size_t processed = 0;
+    CancellationToken cancellation = CancellationToken::Create();
+    Future<void> loop;
+    Future<void> root = scheduler.Add([&] {
+        loop = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+            processed += r.Size();
+            cancellation.Cancel();
+        }, SimplePartitioner());
+    }, cancellation);
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(root.IsReady());
+    BOOST_REQUIRE(loop.IsReady());
+    BOOST_CHECK(IsCancelled(loop));
+    BOOST_CHECK_EQUAL(processed, 1u);
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksCancelled, 10u);
+
+    scheduler.Leave();
+}
+
+namespace
+{
+    // Checks on destruction that the watched future is not ready yet, i.e., that no copy outlives completion
+    struct FutureWatcher
+    {
+        explicit FutureWatcher(Future<void> const* const* future) : mFuture(future) {}
+
+        ~FutureWatcher()
+        {
+            if (*mFuture != nullptr)
+                BOOST_CHECK(!(*mFuture)->IsReady());
+        }
+
+        void operator () (IndexRange<std::size_t> const&) const {}
+
+        Future<void> const* const* mFuture;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(FunctorReleasedBeforeCompletionTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // Only watch the copies held by tasks, the caller's own copy is released when ParallelFor returns
+    Future<void> const* watched = nullptr;
+    Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), std::size_t(64)), FutureWatcher(&watched), SimplePartitioner());
+    watched = &result;
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    watched = nullptr;
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(LazySplitTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // Without thieves, each task only splits off one half, so the task count grows with the depth of the range rather
+    // than its size
+    std::size_t const size = 1 << 16;
+    std::vector<int> runCount(size, 0);
+    Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+        for (auto i = r.Begin(); i != r.End(); ++i)
+            runCount[i]++;
+    });
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK(std::count(runCount.begin(), runCount.end(), 1) == static_cast<std::ptrdiff_t>(size));
+    BOOST_CHECK_LT(scheduler.GetStatistics().tasksExecuted, 64u);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(AutoPartitionerTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // Other contexts entered, but not running tasks
+    Atomic<std::uint32_t> enteredCount(0);
+    Atomic<std::uint32_t> done(0);
+    std::vector<std::shared_ptr<Thread>> others;
+    for (int i = 0; i < 3; ++i)
+    {
+        others.push_back(std::make_shared<Thread>([&] {
+            scheduler.Enter();
+            enteredCount.Increment();
+            while (done.Load() == 0)
+                ThreadYield();
+            scheduler.Leave();
+        }));
+    }
+
+    while (enteredCount.Load() != 3)
+        ThreadYield();
+
+    // Queued work would keep lazy splitting from splitting at all, but the range is still split one part per context
+    Future<void> queued = scheduler.Add([] {});
+    std::size_t const size = 1 << 10;
+    std::size_t processed = 0;
+    Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+        processed += r.Size();
+    });
+    BOOST_CHECK_EQUAL(processed, size / 4);
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK_EQUAL(processed, size);
+
+    done.Store(1);
+    for (std::size_t i = 0; i < others.size(); ++i)
+        others[i]->Join();
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(WorkersTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 3;
+    TaskScheduler scheduler(config);
+
+    // Started from outside the scheduler, and split as workers steal
+    std::size_t const size = 1 << 16;
+    std::vector<int> runCount(size, 0);
+    for (int round = 0; round < 10; ++round)
+    {
+        Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+            for (auto i = r.Begin(); i != r.End(); ++i)
+                runCount[i]++;
+        });
+        scheduler.WaitFor(result);
+    }
+
+    BOOST_CHECK(std::count(runCount.begin(), runCount.end(), 10) == static_cast<std::ptrdiff_t>(size));
+}
+
+BOOST_AUTO_TEST_CASE(SimplePartitionerTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // Every leaf is a task
+    std::size_t const size = 64;
+    std::vector<int> runCount(size, 0);
+    Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size, 4), [&](IndexRange<std::size_t> const& r) {
+        BOOST_CHECK_EQUAL(r.Size(), 4u);
+        for (auto i = r.Begin(); i != r.End(); ++i)
+            runCount[i]++;
+    }, SimplePartitioner());
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK(std::count(runCount.begin(), runCount.end(), 1) == static_cast<std::ptrdiff_t>(size));
+    BOOST_CHECK_GE(scheduler.GetStatistics().tasksExecuted, size / 4 - 1);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(StaticPartitionerTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 3;
+    TaskScheduler scheduler(config);
+
+    // One block per worker, however small the grain size
+    std::size_t const size = 1000;
+    std::vector<int> runCount(size, 0);
+    std::vector<std::size_t> blockSizes(3, 0);
+    Atomic<std::uint32_t> blockCount(0);
+    Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+        blockSizes[blockCount.Increment() % 3] = r.Size();
+        for (auto i = r.Begin(); i != r.End(); ++i)
+            runCount[i]++;
+    }, StaticPartitioner());
+    scheduler.WaitFor(result);
+
+    BOOST_CHECK_EQUAL(blockCount.Load(), 3u);
+    BOOST_CHECK(std::count(runCount.begin(), runCount.end(), 1) == static_cast<std::ptrdiff_t>(size));
+    for (std::size_t i = 0; i < blockSizes.size(); ++i)
+        BOOST_CHECK(blockSizes[i] == 333 || blockSizes[i] == 334);
+
+    // Not split below the grain size
+    blockCount.Store(0);
+    Future<void> coarse = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), std::size_t(8), 8), [&](IndexRange<std::size_t> const&) {
+        blockCount.Increment();
+    }, StaticPartitioner());
+    scheduler.WaitFor(coarse);
+    BOOST_CHECK_EQUAL(blockCount.Load(), 1u);
+
+    // Proportional splits keep blocks at the grain size rather than making one per worker
+    blockCount.Store(0);
+    Atomic<std::uint32_t> smallCount(0);
+    Future<void> clamped = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), std::size_t(16), 8), [&](IndexRange<std::size_t> const& r) {
+        blockCount.Increment();
+        if (r.Size() < 8)
+            smallCount.Increment();
+    }, StaticPartitioner());
+    scheduler.WaitFor(clamped);
+    BOOST_CHECK_EQUAL(blockCount.Load(), 2u);
+    BOOST_CHECK_EQUAL(smallCount.Load(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(AffinityPartitionerTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 3;
+    TaskScheduler scheduler(config);
+
+    // Same blocks every sweep, posted to the contexts that ran them in the previous one
+    std::size_t const size = 1000;
+    std::vector<int> runCount(size, 0);
+    AffinityPartitioner partitioner(2);
+    int const sweepCount = 20;
+    for (int sweep = 0; sweep < sweepCount; ++sweep)
+    {
+        Atomic<std::uint32_t> blockCount(0);
+        Atomic<std::uint32_t> unevenCount(0);
+        Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+            blockCount.Increment();
+            if (r.Size() != 166 && r.Size() != 167)
+                unevenCount.Increment();
+            for (auto i = r.Begin(); i != r.End(); ++i)
+                runCount[i]++;
+        }, partitioner);
+        scheduler.WaitFor(result);
+        BOOST_CHECK_EQUAL(blockCount.Load(), 6u);
+        BOOST_CHECK_EQUAL(unevenCount.Load(), 0u);
+    }
+
+    BOOST_CHECK(std::count(runCount.begin(), runCount.end(), sweepCount) == static_cast<std::ptrdiff_t>(size));
+    BOOST_CHECK(scheduler.GetStatistics().tasksFromMailbox > 0);
+}
+
+namespace
+{
+    // Yields once the flag is set, e.g., by a task it ran
+    class FlagThrottler : public IThrottler
+    {
+    public:
+        explicit FlagThrottler(Atomic<std::uint32_t> const& flag)
+            : mFlag(flag)
+        {}
+
+        virtual bool ShouldYield() CRUNCH_OVERRIDE
+        {
+            return mFlag.Load() != 0;
+        }
+
+    private:
+        Atomic<std::uint32_t> const& mFlag;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(AffinityRepeatTest)
+{
+    TaskScheduler scheduler;
+
+    // Contexts only run when given the turn, so which context takes a block does not depend on thread timing.
+    // The caller is not one of them, and runs the first block itself
+    std::uint32_t const contextCount = 3;
+    Atomic<std::uint32_t> turn(0); // Index + 1 of the context to run once, or 0 if none
+    Atomic<std::uint32_t> singleStep(0); // Set to have contexts yield after running a single block
+    Atomic<std::uint32_t> blockRan(0);
+    Atomic<std::uint32_t> enteredCount(0);
+    Atomic<std::uint32_t> done(0);
+    std::vector<std::uint32_t> contextIds(contextCount);
+    std::vector<std::shared_ptr<Thread>> threads;
+    for (std::uint32_t i = 0; i < contextCount; ++i)
+    {
+        threads.push_back(std::make_shared<Thread>([&, i] {
+            scheduler.Enter();
+            contextIds[i] = scheduler.GetCurrentContextId();
+            enteredCount.Increment();
+
+            NullThrottler nullThrottler;
+            FlagThrottler stepThrottler(blockRan);
+            while (done.Load() == 0)
+            {
+                if (turn.Load() == i + 1)
+                {
+                    blockRan.Store(0);
+                    if (singleStep.Load() != 0)
+                        scheduler.GetContext().Run(stepThrottler);
+                    else
+                        scheduler.GetContext().Run(nullThrottler);
+
+                    turn.Store(0);
+                }
+                else
+                {
+                    ThreadYield();
+                }
+            }
+
+            scheduler.Leave();
+        }));
+    }
+
+    while (enteredCount.Load() != contextCount)
+        ThreadYield();
+
+    auto runContext = [&] (std::uint32_t index)
+    {
+        turn.Store(index + 1);
+        while (turn.Load() != 0)
+            ThreadYield();
+    };
+
+    std::size_t const size = 1200;
+    std::size_t const blocks = contextCount * 2;
+    AffinityPartitioner partitioner(2);
+    int const sweepCount = 10;
+
+    // Context that ran each block, by sweep
+    std::vector<std::vector<std::uint32_t>> blockContextIds(sweepCount, std::vector<std::uint32_t>(blocks, TaskScheduler::InvalidContextId));
+    for (int sweep = 0; sweep < sweepCount; ++sweep)
+    {
+        std::vector<std::uint32_t>& sweepContextIds = blockContextIds[sweep];
+        Future<void> result = ParallelFor(scheduler, MakeIndexRange(std::size_t(0), size), [&](IndexRange<std::size_t> const& r) {
+            sweepContextIds[r.Begin() * blocks / size] = scheduler.GetCurrentContextId();
+            blockRan.Store(1);
+        }, partitioner);
+
+        if (sweep == 0)
+        {
+            // Spread the blocks by having contexts take turns running one at a time, stealing from each other
+            singleStep.Store(1);
+            while (!result.IsReady())
+                for (std::uint32_t i = 0; i < contextCount; ++i)
+                    runContext(i);
+
+            singleStep.Store(0);
+            continue;
+        }
+
+        // Blocks are posted to the contexts that ran them last. Each of those runs once, taking its own posted blocks.
+        // Having had nothing to steal before, it does not yet take blocks posted to others
+        for (std::uint32_t i = 0; i < contextCount; ++i)
+            if (std::count(blockContextIds[sweep - 1].begin(), blockContextIds[sweep - 1].end(), contextIds[i]) != 0)
+                runContext(i);
+
+        // Only if blocks were not posted as recorded is anything left over
+        while (!result.IsReady())
+            for (std::uint32_t i = 0; i < contextCount; ++i)
+                runContext(i);
+    }
+
+    done.Store(1);
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i]->Join();
+
+    // Every sweep after the first runs each block where it ran in the first
+    std::size_t usedCount = 0;
+    for (std::uint32_t i = 0; i < contextCount; ++i)
+        if (std::count(blockContextIds[0].begin(), blockContextIds[0].end(), contextIds[i]) != 0)
+            usedCount++;
+
+    BOOST_TEST_MESSAGE("Contexts running blocks: " << usedCount);
+    for (int sweep = 1; sweep < sweepCount; ++sweep)
+        BOOST_CHECK(blockContextIds[sweep] == blockContextIds[0]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 }}
@@ -0,0 +1,56 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/processor_topology.hpp"
+#include "crunch/test/framework.hpp"
+
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(ProcessorTopologyTests)
+
+namespace
+{
+    // 2 nodes, each with 2 caches of 2 cores with 2 SMT siblings
+    ProcessorTopology CreateTwoSocketTopology()
+    {
+        std::vector<ProcessorInfo> processors;
+        for (std::uint32_t i = 0; i < 16; ++i)
+            processors.push_back(ProcessorInfo(i, i / 2, i / 4, i / 8));
+
+        return ProcessorTopology(processors);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(SharedLevelTest)
+{
+    ProcessorTopology const topology = CreateTwoSocketTopology();
+
+    BOOST_CHECK_EQUAL(ProcessorTopology::GetSharedLevel(topology.Find(0), topology.Find(1)), ProcessorTopology::LEVEL_CORE);
+    BOOST_CHECK_EQUAL(ProcessorTopology::GetSharedLevel(topology.Find(0), topology.Find(3)), ProcessorTopology::LEVEL_CACHE);
+    BOOST_CHECK_EQUAL(ProcessorTopology::GetSharedLevel(topology.Find(0), topology.Find(7)), ProcessorTopology::LEVEL_NODE);
+    BOOST_CHECK_EQUAL(ProcessorTopology::GetSharedLevel(topology.Find(0), topology.Find(8)), ProcessorTopology::LEVEL_REMOTE);
+    BOOST_CHECK_EQUAL(ProcessorTopology::GetSharedLevel(topology.Find(15), topology.Find(14)), ProcessorTopology::LEVEL_CORE);
+
+    // Unknown processors are treated as being on the same node
+    BOOST_CHECK(topology.Find(16) == nullptr);
+    BOOST_CHECK_EQUAL(ProcessorTopology::GetSharedLevel(topology.Find(0), topology.Find(16)), ProcessorTopology::LEVEL_NODE);
+}
+
+BOOST_AUTO_TEST_CASE(DetectTest)
+{
+    ProcessorTopology const topology = ProcessorTopology::Detect();
+    if (topology.IsEmpty())
+        return; // Not supported on this platform
+
+    // Every processor shares its core with itself
+    for (auto it = topology.GetProcessors().begin(); it != topology.GetProcessors().end(); ++it)
+        BOOST_CHECK_EQUAL(ProcessorTopology::GetSharedLevel(&*it, &*it), ProcessorTopology::LEVEL_CORE);
+
+    BOOST_CHECK(topology.Find(ProcessorTopology::GetCurrentProcessor()) != nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
@@ -0,0 +1,105 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/thread.hpp"
+#include "crunch/concurrency/detail/task_allocator.hpp"
+#include "crunch/test/framework.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+BOOST_AUTO_TEST_SUITE(TaskAllocatorTests)
+
+BOOST_AUTO_TEST_CASE(AllocationSizeTest)
+{
+    BOOST_CHECK_EQUAL(TaskAllocator::GetAllocationSize(1), 64u);
+    BOOST_CHECK_EQUAL(TaskAllocator::GetAllocationSize(64), 64u);
+    BOOST_CHECK_EQUAL(TaskAllocator::GetAllocationSize(65), 128u);
+    BOOST_CHECK_EQUAL(TaskAllocator::GetAllocationSize(TaskAllocator::MaxBlockSize), TaskAllocator::MaxBlockSize);
+    BOOST_CHECK_EQUAL(TaskAllocator::GetAllocationSize(TaskAllocator::MaxBlockSize + 1), TaskAllocator::MaxBlockSize + 1);
+}
+
+BOOST_AUTO_TEST_CASE(LocalReuseTest)
+{
+    TaskAllocator allocator;
+
+    std::uint32_t const size = TaskAllocator::GetAllocationSize(100);
+    void* a = allocator.Allocate(size);
+    void* b = allocator.Allocate(size);
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(a) % size, 0u);
+
+    // Freed blocks are reused LIFO
+    TaskAllocator::Free(a, size, &allocator);
+    BOOST_CHECK_EQUAL(allocator.Allocate(size), a);
+
+    TaskAllocator::Free(a, size, &allocator);
+    TaskAllocator::Free(b, size, &allocator);
+
+    // Large allocations bypass slabs
+    std::uint32_t const largeSize = TaskAllocator::GetAllocationSize(TaskAllocator::MaxBlockSize * 2);
+    void* large = allocator.Allocate(largeSize);
+    TaskAllocator::Free(large, largeSize, &allocator);
+}
+
+BOOST_AUTO_TEST_CASE(RemoteFreeTest)
+{
+    TaskAllocator allocator;
+
+    std::uint32_t const size = TaskAllocator::GetAllocationSize(64);
+    int const count = 10000;
+    std::vector<void*> blocks;
+    for (int i = 0; i < count; ++i)
+        blocks.push_back(allocator.Allocate(size));
+
+    // Free from another thread, without an allocator of its own
+    Thread t([&] {
+        for (int i = 0; i < count; ++i)
+            TaskAllocator::Free(blocks[i], size, nullptr);
+    });
+    t.Join();
+
+    // All blocks should be reclaimed from the remote free list before new slab memory is used
+    std::vector<void*> reallocated;
+    for (int i = 0; i < count; ++i)
+        reallocated.push_back(allocator.Allocate(size));
+
+    std::sort(blocks.begin(), blocks.end());
+    std::sort(reallocated.begin(), reallocated.end());
+    BOOST_CHECK(blocks == reallocated);
+
+    for (int i = 0; i < count; ++i)
+        TaskAllocator::Free(reallocated[i], size, &allocator);
+}
+
+BOOST_AUTO_TEST_CASE(OrphanedSlabTest)
+{
+    std::uint32_t const size = TaskAllocator::GetAllocationSize(64);
+    std::vector<void*> blocks;
+    {
+        TaskAllocator allocator;
+        for (int i = 0; i < 2000; ++i)
+            blocks.push_back(allocator.Allocate(size));
+
+        // Some blocks freed before destruction, locally and remotely
+        TaskAllocator::Free(blocks.back(), size, &allocator);
+        blocks.pop_back();
+        TaskAllocator::Free(blocks.back(), size, nullptr);
+        blocks.pop_back();
+    }
+
+    // Blocks outliving the allocator stay usable, and the last freed from each slab releases it
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        *static_cast<std::size_t*>(blocks[i]) = i;
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        BOOST_CHECK_EQUAL(*static_cast<std::size_t*>(blocks[i]), i);
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+        TaskAllocator::Free(blocks[i], size, nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}}
@@ -7,12 +7,19 @@
 #include "crunch/concurrency/task.hpp"
 #include "crunch/concurrency/task_scheduler.hpp"
 #include "crunch/concurrency/thread.hpp"
+#include "crunch/concurrency/yield.hpp"
 #include "crunch/containers/small_vector.hpp"
 
+#include "waiting_tasks.hpp"
+
 #include <boost/test/test_tools.hpp>
 #include <boost/test/unit_test_suite.hpp>
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <tuple>
 #include <vector>
 
@@ -25,22 +32,13 @@ BOOST_AUTO_TEST_CASE(ContinuationTest)
     MetaScheduler::Config config;
     MetaScheduler metaScheduler(config);
     MetaScheduler::Context& metaSchedulerContext = metaScheduler.AcquireContext();
-    TaskScheduler scheduler;
+    TaskScheduler::Config schedulerConfig;
+    schedulerConfig.workerCount = 1;
+    TaskScheduler scheduler(schedulerConfig);
     // TODO: pass flag to TaskScheduler constructor to say if it should become the global default scheduler
     gDefaultTaskScheduler = &scheduler;
     scheduler.Enter();
 
-    NullThrottler throttler;
-
-    volatile bool done = false;
-
-    Thread t([&] {
-        scheduler.Enter();
-        while (!done)
-            scheduler.GetContext().Run(throttler);
-        scheduler.Leave();
-    });
-
     Future<int> f = scheduler.Add([&] () -> Future<int> {
         std::cout << "initial" << std::endl;
 
@@ -79,13 +77,719 @@ BOOST_AUTO_TEST_CASE(ContinuationTest)
     });
     WaitFor(f3);
 
-    done = true;
-    t.Join();
-
     scheduler.Leave();
     metaSchedulerContext.Release();
 }
 
+BOOST_AUTO_TEST_CASE(FutureLifetimeTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+    int runCount = 0;
+
+    // Future released before task runs
+    scheduler.Add([&] { runCount++; });
+
+    // Future outlives task
+    Future<std::vector<int>> result = scheduler.Add([&] () -> std::vector<int> {
+        runCount++;
+        return std::vector<int>(100, 1);
+    });
+
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK_EQUAL(runCount, 2);
+    BOOST_REQUIRE(result.IsReady());
+    BOOST_CHECK_EQUAL(result.Get().size(), 100u);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(SchedulerLifetimeTest)
+{
+    // Futures may outlive the scheduler whose allocators hold their data
+    Future<std::vector<int>> external;
+    std::vector<Future<int>> internal;
+    {
+        TaskScheduler::Config config;
+        config.workerCount = 2;
+        TaskScheduler scheduler(config);
+
+        external = scheduler.Add([] { return std::vector<int>(100, 1); });
+        Future<void> spawner = scheduler.Add([&] {
+            for (int i = 0; i < 100; ++i)
+                internal.push_back(scheduler.Add([i] { return i; }));
+        });
+        scheduler.WaitFor(spawner);
+        for (std::size_t i = 0; i < internal.size(); ++i)
+            scheduler.WaitFor(internal[i]);
+        scheduler.WaitFor(external);
+    }
+
+    BOOST_CHECK_EQUAL(external.Get().size(), 100u);
+    for (std::size_t i = 0; i < internal.size(); ++i)
+        BOOST_CHECK_EQUAL(internal[i].Get(), static_cast<int>(i));
+
+    // Released last, freeing the orphaned slabs
+    external = Future<std::vector<int>>();
+    internal.clear();
+}
+
+BOOST_AUTO_TEST_CASE(ExternalSubmissionTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 2;
+    TaskScheduler scheduler(config);
+
+    int const producerCount = 4;
+    int const taskCount = 1000;
+    Atomic<std::uint32_t> runCount(0);
+    std::vector<std::vector<Future<void>>> results(producerCount);
+
+    std::vector<std::shared_ptr<Thread>> producers;
+    for (int p = 0; p < producerCount; ++p)
+    {
+        producers.push_back(std::make_shared<Thread>([&, p] {
+            for (int i = 0; i < taskCount; ++i)
+                results[p].push_back(scheduler.Add([&] { runCount.Increment(); }));
+        }));
+    }
+
+    for (int p = 0; p < producerCount; ++p)
+    {
+        producers[p]->Join();
+        std::for_each(results[p].begin(), results[p].end(), [] (Future<void>& f) { WaitFor(f); });
+    }
+
+    BOOST_CHECK_EQUAL(runCount.Load(), static_cast<std::uint32_t>(producerCount * taskCount));
+}
+
+BOOST_AUTO_TEST_CASE(WorkerShutdownTest)
+{
+    // Workers must wake up and exit whether they are parked or busy
+    for (int i = 0; i < 100; ++i)
+    {
+        TaskScheduler::Config config;
+        config.workerCount = 4;
+        TaskScheduler scheduler(config);
+        if (i % 2)
+            scheduler.Add([] {});
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ShutdownCancelTest)
+{
+    // Tasks still queued when the scheduler is destroyed are cancelled, rather than leaked along with their memory
+    std::vector<Future<void>> futures;
+    {
+        TaskScheduler scheduler;
+        scheduler.Enter();
+        futures.push_back(scheduler.Add([] {}));
+        scheduler.Leave();
+
+        futures.push_back(scheduler.Add([] {}));
+    }
+
+    for (std::size_t i = 0; i < futures.size(); ++i)
+        BOOST_CHECK(IsCancelled(futures[i]));
+}
+
+BOOST_AUTO_TEST_CASE(InjectedTopologyTest)
+{
+    // Four processors in pairs on two nodes, sharing no cores or caches. Pinned workers take the processor they are
+    // pinned to, even where it does not exist, so each has one neighbor on its node and two remote
+    std::vector<ProcessorInfo> processors;
+    for (std::uint32_t p = 0; p < 4; ++p)
+        processors.push_back(ProcessorInfo(p, p, p, p / 2));
+
+    TaskScheduler::Config config;
+    config.workerCount = 4;
+    config.workerAffinity.push_back(0);
+    config.workerAffinity.push_back(1);
+    config.workerAffinity.push_back(2);
+    config.workerAffinity.push_back(3);
+    config.topology = ProcessorTopology(processors);
+    TaskScheduler scheduler(config);
+
+    while (scheduler.GetStatistics().contextCount != 4)
+        ThreadYield();
+
+    int const taskCount = 1000;
+    Atomic<std::uint32_t> runCount(0);
+
+    // Spawn from within a worker, so other workers must steal to help. The first round lets all workers see each other
+    auto runRound = [&] {
+        Future<void> done = scheduler.Add([&] {
+            for (int i = 0; i < taskCount; ++i)
+                scheduler.Add([&] { runCount.Increment(); });
+        });
+        WaitFor(done);
+        while (runCount.Load() % taskCount != 0)
+            ThreadYield();
+    };
+
+    runRound();
+    TaskScheduler::Statistics const before = scheduler.GetStatistics();
+    runRound();
+    TaskScheduler::Statistics const after = scheduler.GetStatistics();
+
+    BOOST_CHECK_EQUAL(runCount.Load(), static_cast<std::uint32_t>(2 * taskCount));
+
+    std::uint64_t attempts[ProcessorTopology::LEVEL_COUNT];
+    for (std::uint32_t level = 0; level < ProcessorTopology::LEVEL_COUNT; ++level)
+        attempts[level] = after.stealAttemptsByLevel[level] - before.stealAttemptsByLevel[level];
+
+    // Victims are picked by the injected topology, not by the processors actually shared, and the neighbor on the
+    // same node is tried before remote ones on every attempt
+    BOOST_CHECK_EQUAL(attempts[ProcessorTopology::LEVEL_CORE], 0u);
+    BOOST_CHECK_EQUAL(attempts[ProcessorTopology::LEVEL_CACHE], 0u);
+    BOOST_CHECK_GT(attempts[ProcessorTopology::LEVEL_NODE], 0u);
+    BOOST_CHECK_GE(attempts[ProcessorTopology::LEVEL_NODE], attempts[ProcessorTopology::LEVEL_REMOTE]);
+}
+
+BOOST_AUTO_TEST_CASE(StealPolicyStatesTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 2;
+    config.minStealAttempts = 4;
+    config.maxStealAttempts = 64;
+    TaskScheduler scheduler(config);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        Future<void> f = scheduler.Add([] {});
+        WaitFor(f);
+    }
+
+    // Workers enter asynchronously, so they may not all be listed yet
+    std::vector<TaskScheduler::StealPolicyState> const states = scheduler.GetStealPolicyStates();
+    BOOST_CHECK(states.size() <= 2);
+    for (auto it = states.begin(); it != states.end(); ++it)
+    {
+        BOOST_CHECK(it->attemptBudget >= 4 && it->attemptBudget <= 64);
+        BOOST_CHECK(it->backoffLimit >= 1);
+        BOOST_CHECK(it->successRate >= 0.0 && it->successRate <= 1.0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(HandOffChainTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // Chain longer than the max hand off chain length, to also cover continuations falling back to the queue
+    int const chainLength = 1000;
+    int runCount = 0;
+    std::vector<Future<void>> chain;
+    chain.push_back(scheduler.Add([&] { runCount++; }));
+    for (int i = 1; i < chainLength; ++i)
+    {
+        IWaitable* dependency = &chain.back();
+        chain.push_back(scheduler.Add([&, i] { BOOST_CHECK_EQUAL(runCount, i); runCount++; }, &dependency, 1));
+    }
+
+    // Other work made ready by the chain must not be held back
+    IWaitable* dependency = &chain[chainLength / 2];
+    Future<void> sibling = scheduler.Add([] {}, &dependency, 1);
+
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK_EQUAL(runCount, chainLength);
+    BOOST_CHECK(chain.back().IsReady());
+    BOOST_CHECK(sibling.IsReady());
+
+    chain.clear();
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(PriorityTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    int const countPerLevel = 10;
+    std::vector<TaskPriority> order;
+    TaskPriority const priorities[] = { TASK_PRIORITY_BACKGROUND, TASK_PRIORITY_NORMAL, TASK_PRIORITY_HIGH };
+    for (int p = 0; p < 3; ++p)
+    {
+        TaskPriority const priority = priorities[p];
+        for (int i = 0; i < countPerLevel; ++i)
+            scheduler.Add([&order, priority] { order.push_back(priority); }, priority);
+    }
+
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE_EQUAL(order.size(), static_cast<std::size_t>(3 * countPerLevel));
+
+    // Highest priority first, regardless of order added
+    for (int i = 0; i < countPerLevel; ++i)
+        BOOST_CHECK_EQUAL(order[i], TASK_PRIORITY_HIGH);
+
+    // Lower priorities are not starved while higher priority work remains
+    auto const firstBackground = std::find(order.begin(), order.end(), TASK_PRIORITY_BACKGROUND);
+    auto const lastNormal = std::find(order.rbegin(), order.rend(), TASK_PRIORITY_NORMAL).base();
+    BOOST_CHECK(firstBackground < lastNormal);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(StatisticsTest)
+{
+    TaskScheduler scheduler;
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().contextCount, 0u);
+
+    scheduler.Enter();
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().contextCount, 1u);
+
+    NullThrottler throttler;
+    int const taskCount = 100;
+    for (int i = 0; i < taskCount; ++i)
+        scheduler.Add([] {});
+    scheduler.GetContext().Run(throttler);
+
+    TaskScheduler::Statistics statistics = scheduler.GetStatistics();
+    BOOST_CHECK_EQUAL(statistics.tasksExecuted, static_cast<std::uint64_t>(taskCount));
+    BOOST_CHECK_EQUAL(statistics.queueHighWaterMark, static_cast<std::uint64_t>(taskCount));
+    BOOST_CHECK(statistics.queueGrowCount >= 1);
+    BOOST_CHECK_EQUAL(statistics.idleTransitions, 1u);
+
+    // Counters are kept after contexts leave
+    scheduler.Leave();
+    statistics = scheduler.GetStatistics();
+    BOOST_CHECK_EQUAL(statistics.contextCount, 0u);
+    BOOST_CHECK_EQUAL(statistics.tasksExecuted, static_cast<std::uint64_t>(taskCount));
+
+    // Tasks added from outside the scheduler go through the injection queue
+    scheduler.Enter();
+    Thread producer([&] { scheduler.Add([] {}); });
+    producer.Join();
+    scheduler.GetContext().Run(throttler);
+    scheduler.Leave();
+
+    statistics = scheduler.GetStatistics();
+    BOOST_CHECK_EQUAL(statistics.tasksExecuted, static_cast<std::uint64_t>(taskCount + 1));
+    BOOST_CHECK_EQUAL(statistics.tasksInjected, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(AffinityTest)
+{
+    TaskScheduler scheduler;
+    BOOST_CHECK_EQUAL(scheduler.GetCurrentContextId(), TaskScheduler::InvalidContextId);
+
+    scheduler.Enter();
+    std::uint32_t const contextId = scheduler.GetCurrentContextId();
+    BOOST_CHECK(contextId != TaskScheduler::InvalidContextId);
+
+    // Post from another context, which is gone by the time the tasks run
+    int const taskCount = 10;
+    std::vector<std::uint32_t> runOn;
+    std::vector<Future<void>> futures;
+    Thread producer([&]
+    {
+        scheduler.Enter();
+        BOOST_CHECK(scheduler.GetCurrentContextId() != contextId);
+        for (int i = 0; i < taskCount; ++i)
+            futures.push_back(scheduler.Add([&] { runOn.push_back(scheduler.GetCurrentContextId()); }, TaskAffinity::ForContext(contextId)));
+        scheduler.Leave();
+    });
+    producer.Join();
+
+    // Hints not matching any context are ignored
+    futures.push_back(scheduler.Add([] {}, TaskAffinity::ForContext(contextId + 100)));
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK_EQUAL(runOn.size(), static_cast<std::size_t>(taskCount));
+    BOOST_CHECK(std::count(runOn.begin(), runOn.end(), contextId) == taskCount);
+    for (auto it = futures.begin(); it != futures.end(); ++it)
+        BOOST_CHECK(it->IsReady());
+
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksFromMailbox, static_cast<std::uint64_t>(taskCount));
+
+    // Tasks posted to a context that has left are forwarded to the others
+    Thread other([&]
+    {
+        scheduler.Enter();
+        std::uint32_t const otherId = scheduler.GetCurrentContextId();
+        std::vector<Future<void>> posted;
+        Thread poster([&] { posted.push_back(scheduler.Add([] {}, TaskAffinity::ForContext(otherId))); });
+        poster.Join();
+        scheduler.Leave();
+        futures.swap(posted);
+    });
+    other.Join();
+
+    scheduler.GetContext().Run(throttler);
+    BOOST_REQUIRE_EQUAL(futures.size(), 1u);
+    BOOST_CHECK(futures[0].IsReady());
+
+    futures.clear();
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(CancellationTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // Tasks cancelled before they start are skipped
+    int runCount = 0;
+    CancellationToken cancellation = CancellationToken::Create();
+    Future<void> skipped = scheduler.Add([&] { runCount++; }, cancellation);
+    Future<int> skippedValue = scheduler.Add([&] { return ++runCount; }, cancellation);
+    Future<void> unrelated = scheduler.Add([&] { runCount++; });
+    cancellation.Cancel();
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK_EQUAL(runCount, 1);
+    BOOST_CHECK(skipped.IsReady() && IsCancelled(skipped));
+    BOOST_CHECK(skippedValue.IsReady() && IsCancelled(skippedValue));
+    BOOST_CHECK_EQUAL(skippedValue.Get(), 0);
+    BOOST_CHECK(unrelated.IsReady() && !IsCancelled(unrelated));
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksCancelled, 2u);
+
+    // Tasks added by a task inherit its token, as does its continuation
+    runCount = 0;
+    cancellation = CancellationToken::Create();
+    Future<int> root = scheduler.Add([&] () -> Future<int>
+    {
+        for (int i = 0; i < 10; ++i)
+            scheduler.Add([&] { runCount++; });
+
+        Future<int> child = scheduler.Add([&] { return ++runCount; });
+        cancellation.Cancel();
+        return child;
+    }, cancellation);
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK_EQUAL(runCount, 0);
+    BOOST_CHECK(root.IsReady() && IsCancelled(root));
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksCancelled, 2u + 12u);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(WaitForTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // Without workers, waiting inside a task only completes by running the awaited task on the waiting context
+    int result = 0;
+    Future<void> root = scheduler.Add([&]
+    {
+        Future<int> child = scheduler.Add([] { return 42; });
+        scheduler.WaitFor(child);
+        BOOST_CHECK(child.IsReady());
+        result = child.Get();
+    });
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK(root.IsReady());
+    BOOST_CHECK_EQUAL(result, 42);
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksHelped, 1u);
+
+    // Waiting from an entered thread outside of any task helps too
+    Future<int> value = scheduler.Add([] { return 7; });
+    scheduler.WaitFor(value);
+    BOOST_CHECK_EQUAL(value.Get(), 7);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(WaitForStressTest)
+{
+    // Every task blocks on a child. Without helping, workers would all end up waiting and deadlock
+    TaskScheduler::Config config;
+    config.workerCount = 2;
+    TaskScheduler scheduler(config);
+
+    Test::CheckWaitingFib(scheduler);
+}
+
+namespace
+{
+    // Counts copies, which tasks should never make of results
+    struct CopyCounted
+    {
+        explicit CopyCounted(int& copyCount)
+            : copyCount(&copyCount)
+            , values(1 << 10, 1)
+        {}
+
+        CopyCounted(CopyCounted const& rhs)
+            : copyCount(rhs.copyCount)
+            , values(rhs.values)
+        {
+            (*copyCount)++;
+        }
+
+        CopyCounted(CopyCounted&& rhs)
+            : copyCount(rhs.copyCount)
+            , values(std::move(rhs.values))
+        {}
+
+        CopyCounted& operator = (CopyCounted const& rhs)
+        {
+            values = rhs.values;
+            (*copyCount)++;
+            return *this;
+        }
+
+        CopyCounted& operator = (CopyCounted&& rhs)
+        {
+            values = std::move(rhs.values);
+            return *this;
+        }
+
+        int* copyCount;
+        std::vector<int> values;
+    };
+
+    // Move-only, with a mutable call operator
+    class MoveOnlySum
+    {
+    public:
+        explicit MoveOnlySum(int count)
+            : mValues(new std::vector<int>(count, 1))
+        {}
+
+        MoveOnlySum(MoveOnlySum&& rhs)
+            : mValues(std::move(rhs.mValues))
+        {}
+
+        int operator () ()
+        {
+            int sum = 0;
+            for (auto it = mValues->begin(); it != mValues->end(); ++it)
+                sum += *it;
+
+            mValues.reset();
+            return sum;
+        }
+
+    private:
+        MoveOnlySum(MoveOnlySum const&);
+
+        std::unique_ptr<std::vector<int>> mValues;
+    };
+}
+
+BOOST_AUTO_TEST_CASE(MoveOnlyTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    Future<int> sum = scheduler.Add(MoveOnlySum(10));
+
+    int calls = 0;
+    Future<int> mutableResult = scheduler.Add([calls] () mutable { return ++calls; });
+
+    // Results are moved into the future, and through the continuation of a task returning a future
+    int copyCount = 0;
+    Future<CopyCounted> direct = scheduler.Add([&] { return CopyCounted(copyCount); });
+    Future<CopyCounted> unwrapped = scheduler.Add([&]
+    {
+        return scheduler.Add([&] { return CopyCounted(copyCount); });
+    });
+
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK_EQUAL(sum.Get(), 10);
+    BOOST_CHECK_EQUAL(mutableResult.Get(), 1);
+
+    CopyCounted const directValue = TakeResult(std::move(direct));
+    CopyCounted const unwrappedValue = TakeResult(std::move(unwrapped));
+    BOOST_CHECK_EQUAL(directValue.values.size(), 1u << 10);
+    BOOST_CHECK_EQUAL(unwrappedValue.values.size(), 1u << 10);
+    BOOST_CHECK_EQUAL(copyCount, 0);
+
+    // Shared futures are copied from
+    Future<CopyCounted> shared = scheduler.Add([&] { return CopyCounted(copyCount); });
+    scheduler.GetContext().Run(throttler);
+    Future<CopyCounted> sharedCopy = shared;
+    CopyCounted const sharedValue = TakeResult(std::move(shared));
+    BOOST_CHECK_EQUAL(copyCount, 1);
+    BOOST_CHECK_EQUAL(sharedCopy.Get().values.size(), 1u << 10);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(ThenTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    int copyCount = 0;
+    Task<CopyCounted> first([&] { return CopyCounted(copyCount); }, scheduler);
+    Task<std::size_t> second = first.Then([] (CopyCounted const& value) { return value.values.size(); });
+    Task<std::size_t> third = second >> [] (std::size_t size) { return size * 2; };
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(third.GetFuture().IsReady());
+    BOOST_CHECK_EQUAL(third.GetFuture().Get(), 2u << 10);
+    BOOST_CHECK_EQUAL(copyCount, 0);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(AddIntoTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    int copyCount = 0;
+    CopyCounted first(copyCount);
+    CopyCounted second(copyCount);
+    first.values.clear();
+    second.values.clear();
+
+    // The second task depends on the first, and reads its result in place
+    Future<void> firstDone = scheduler.AddInto(first, [&] { return CopyCounted(copyCount); });
+    IWaitable* dependency = &firstDone;
+    Future<void> secondDone = scheduler.AddInto(second, [&]
+    {
+        CopyCounted result(copyCount);
+        result.values.resize(first.values.size() * 2, 2);
+        return result;
+    }, &dependency, 1);
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(secondDone.IsReady());
+    BOOST_CHECK_EQUAL(first.values.size(), 1u << 10);
+    BOOST_CHECK_EQUAL(second.values.size(), 2u << 10);
+    BOOST_CHECK_EQUAL(copyCount, 0);
+
+    // Cancelled tasks leave the destination untouched
+    int untouched = 1;
+    CancellationToken cancellation = CancellationToken::Create();
+    cancellation.Cancel();
+    Future<void> cancelled = scheduler.AddInto(untouched, [] { return 2; }, nullptr, 0, TASK_PRIORITY_NORMAL, TaskAffinity(), cancellation);
+    scheduler.GetContext().Run(throttler);
+    BOOST_CHECK(IsCancelled(cancelled));
+    BOOST_CHECK_EQUAL(untouched, 1);
+
+    scheduler.Leave();
+}
+
+namespace
+{
+    struct LargeBlock
+    {
+        float values[1 << 16];
+    };
+}
+
+BOOST_AUTO_TEST_CASE(AddIntoFillTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // Filled in place through a reference, so no temporary of the block is built on the task's stack
+    std::unique_ptr<LargeBlock> block(new LargeBlock);
+    LargeBlock* filled = nullptr;
+    Future<void> done = scheduler.AddInto(*block, [&] (LargeBlock& destination)
+    {
+        filled = &destination;
+        for (std::size_t i = 0; i < sizeof(destination.values) / sizeof(float); ++i)
+            destination.values[i] = static_cast<float>(i);
+    });
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(done.IsReady());
+    BOOST_CHECK_EQUAL(filled, block.get());
+    BOOST_CHECK_EQUAL(block->values[0], 0.0f);
+    BOOST_CHECK_EQUAL(block->values[12345], 12345.0f);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(AddDetachedTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // No future to observe completion through, so the functor reports it
+    int runCount = 0;
+    scheduler.AddDetached([&] { runCount++; });
+    scheduler.AddDetached([&] { runCount++; }, TASK_PRIORITY_HIGH, TaskAffinity(), CancellationToken());
+    scheduler.GetContext().Run(throttler);
+    BOOST_CHECK_EQUAL(runCount, 2);
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksExecuted, 2u);
+
+    // A cancelled task is destroyed without running, releasing what it holds
+    std::shared_ptr<int> held = std::make_shared<int>(0);
+    CancellationToken cancellation = CancellationToken::Create();
+    scheduler.AddDetached([&runCount, held] { runCount++; }, cancellation);
+    BOOST_CHECK_EQUAL(held.use_count(), 2);
+    cancellation.Cancel();
+    scheduler.GetContext().Run(throttler);
+    BOOST_CHECK_EQUAL(runCount, 2);
+    BOOST_CHECK_EQUAL(held.use_count(), 1);
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksCancelled, 1u);
+
+    scheduler.Leave();
+
+    // Added from outside the scheduler through the injection queue
+    TaskScheduler::Config config;
+    config.workerCount = 1;
+    TaskScheduler workerScheduler(config);
+    Atomic<std::uint32_t> injectedRan(0);
+    workerScheduler.AddDetached([&] { injectedRan.Store(1); });
+    while (injectedRan.Load() == 0)
+        ThreadYield();
+}
+
+#if CRUNCH_CONCURRENCY_TASKS_TRACING
+BOOST_AUTO_TEST_CASE(TraceTest)
+{
+    TaskScheduler::Config config;
+    config.traceCapacity = 1024;
+    TaskScheduler scheduler(config);
+    scheduler.Enter();
+
+    NullThrottler throttler;
+    for (int i = 0; i < 10; ++i)
+        scheduler.Add([] {});
+    scheduler.GetContext().Run(throttler);
+
+    scheduler.Leave();
+
+    // Trace outlives the context
+    std::ostringstream stream;
+    scheduler.WriteTrace(stream);
+    std::string const trace = stream.str();
+
+    std::size_t spawnCount = 0;
+    for (std::size_t pos = trace.find("\"Spawn\""); pos != std::string::npos; pos = trace.find("\"Spawn\"", pos + 1))
+        spawnCount++;
+
+    BOOST_CHECK_EQUAL(spawnCount, 10u);
+    BOOST_CHECK(trace.find("\"name\":\"Task\",\"ph\":\"B\"") != std::string::npos);
+}
+#endif
+
 #if 0
 BOOST_AUTO_TEST_CASE(RemoveMe)
 {
@@ -0,0 +1,92 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/detail/trace_ring.hpp"
+#include "crunch/concurrency/thread.hpp"
+#include "crunch/test/framework.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace Crunch { namespace Concurrency { namespace Detail {
+
+BOOST_AUTO_TEST_SUITE(TraceRingTests)
+
+BOOST_AUTO_TEST_CASE(WrapAroundTest)
+{
+    TraceRing ring(0, 6); // Rounded up to 8
+
+    std::vector<TraceEvent> events;
+    ring.CopyEvents(events);
+    BOOST_CHECK(events.empty());
+
+    for (std::uint64_t i = 0; i < 5; ++i)
+        ring.Record(TRACE_EVENT_SPAWN, i);
+
+    ring.CopyEvents(events);
+    BOOST_REQUIRE_EQUAL(events.size(), 5u);
+    for (std::uint64_t i = 0; i < 5; ++i)
+        BOOST_CHECK_EQUAL(events[i].argument, i);
+
+    // Only the most recent events are kept, oldest first
+    for (std::uint64_t i = 5; i < 20; ++i)
+        ring.Record(TRACE_EVENT_STEAL_ATTEMPT, i);
+
+    events.clear();
+    ring.CopyEvents(events);
+    BOOST_REQUIRE_EQUAL(events.size(), 7u);
+    for (std::size_t i = 0; i < events.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(events[i].argument, 13 + i);
+        BOOST_CHECK_EQUAL(events[i].type, TRACE_EVENT_STEAL_ATTEMPT);
+        if (i > 0)
+            BOOST_CHECK(events[i].timestamp >= events[i - 1].timestamp);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentCopyTest)
+{
+    // Events copied while the ring is written must be consecutive
+    TraceRing ring(0, 64);
+    volatile bool done = false;
+    Thread writer([&] {
+        for (std::uint64_t i = 1; i < 200000; ++i)
+            ring.Record(TRACE_EVENT_SPAWN, i);
+        done = true;
+    });
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        std::vector<TraceEvent> events;
+        ring.CopyEvents(events);
+        for (std::size_t j = 1; j < events.size(); ++j)
+            BOOST_REQUIRE_EQUAL(events[j].argument, events[j - 1].argument + 1);
+    }
+
+    writer.Join();
+}
+
+BOOST_AUTO_TEST_CASE(ChromeTraceTest)
+{
+    TraceRing ring(3, 16);
+    ring.Record(TRACE_EVENT_DISPATCH_BEGIN, 0x1234);
+    ring.Record(TRACE_EVENT_DISPATCH_END, 0);
+    ring.Record(TRACE_EVENT_STEAL_SUCCESS, 0x5678);
+
+    std::vector<TraceRing const*> rings(1, &ring);
+    std::ostringstream stream;
+    WriteChromeTrace(stream, rings);
+    std::string const trace = stream.str();
+
+    BOOST_CHECK(trace.find("{\"traceEvents\":[") == 0);
+    BOOST_CHECK(trace.find("\"name\":\"Context 3\"") != std::string::npos);
+    BOOST_CHECK(trace.find("\"name\":\"Task\",\"ph\":\"B\"") != std::string::npos);
+    BOOST_CHECK(trace.find("\"name\":\"Task\",\"ph\":\"E\"") != std::string::npos);
+    BOOST_CHECK(trace.find("\"task\":\"0x1234\"") != std::string::npos);
+    BOOST_CHECK(trace.find("\"name\":\"Steal\",\"ph\":\"i\"") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}}
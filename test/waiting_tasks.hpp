@@ -0,0 +1,49 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#ifndef CRUNCH_CONCURRENCY_TEST_WAITING_TASKS_HPP
+#define CRUNCH_CONCURRENCY_TEST_WAITING_TASKS_HPP
+
+#include "crunch/concurrency/task_scheduler.hpp"
+
+#include <boost/test/test_tools.hpp>
+
+namespace Crunch { namespace Concurrency { namespace Test {
+
+// Chain of depth tasks, each waiting on the next. Returns depth
+inline int WaitingChain(TaskScheduler& scheduler, int depth)
+{
+    if (depth == 0)
+        return 0;
+
+    Future<int> next = scheduler.Add([&scheduler, depth] { return WaitingChain(scheduler, depth - 1); });
+    scheduler.WaitFor(next);
+    return next.Get() + 1;
+}
+
+// Fibonacci where every task blocks on a child it added, while computing the other half itself
+inline int WaitingFib(TaskScheduler& scheduler, int n)
+{
+    if (n < 2)
+        return n;
+
+    Future<int> a = scheduler.Add([&scheduler, n] { return WaitingFib(scheduler, n - 1); });
+    int const b = WaitingFib(scheduler, n - 2);
+    scheduler.WaitFor(a);
+    return a.Get() + b;
+}
+
+// Repeatedly waits on WaitingFib from outside the scheduler, which must have workers
+inline void CheckWaitingFib(TaskScheduler& scheduler)
+{
+    for (int i = 0; i < 20; ++i)
+    {
+        Future<int> result = scheduler.Add([&scheduler] { return WaitingFib(scheduler, 14); });
+        scheduler.WaitFor(result);
+        BOOST_CHECK_EQUAL(result.Get(), 377);
+    }
+}
+
+}}}
+
+#endif
@@ -0,0 +1,95 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/when_all.hpp"
+#include "crunch/concurrency/thread.hpp"
+#include "crunch/test/framework.hpp"
+
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(WhenAllTests)
+
+BOOST_AUTO_TEST_CASE(VariadicTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    int runCount = 0;
+    Future<void> a = scheduler.Add([&] { runCount++; });
+    Future<int> b = scheduler.Add([&] { return ++runCount; });
+    Future<void> all = WhenAll(scheduler, a, b);
+    BOOST_CHECK(!all.IsReady());
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_CHECK_EQUAL(runCount, 2);
+    BOOST_CHECK(all.IsReady());
+    BOOST_CHECK(!IsCancelled(all));
+
+    // Joining futures that are all ready completes immediately
+    BOOST_CHECK(WhenAll(scheduler, a, b).IsReady());
+
+    // Joining runs no task
+    BOOST_CHECK_EQUAL(scheduler.GetStatistics().tasksExecuted, 2u);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(RangeTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+
+    // Empty range is ready immediately
+    std::vector<Future<void>> futures;
+    BOOST_CHECK(WhenAll(scheduler, futures).IsReady());
+
+    // Larger joins than fit the task allocator's largest block
+    for (int count = 1; count <= 64; count *= 4)
+    {
+        int runCount = 0;
+        futures.clear();
+        for (int i = 0; i < count; ++i)
+            futures.push_back(scheduler.Add([&] { runCount++; }));
+
+        Future<void> all = WhenAll(scheduler, futures);
+        IWaitable* dependency = &all;
+        Future<void> after = scheduler.Add([&] { BOOST_CHECK_EQUAL(runCount, count); }, &dependency, 1);
+        scheduler.GetContext().Run(throttler);
+
+        BOOST_CHECK_EQUAL(runCount, count);
+        BOOST_CHECK(all.IsReady());
+        BOOST_CHECK(after.IsReady());
+    }
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 2;
+    TaskScheduler scheduler(config);
+
+    // Dependencies completing on worker threads while the join is being set up from outside
+    for (int i = 0; i < 100; ++i)
+    {
+        Atomic<std::uint32_t> runCount(0);
+        std::vector<Future<void>> futures;
+        for (int j = 0; j < 8; ++j)
+            futures.push_back(scheduler.Add([&] { runCount.Increment(); }));
+
+        Future<void> all = WhenAll(scheduler, futures);
+        all.Get();
+        BOOST_CHECK_EQUAL(runCount.Load(), 8u);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
@@ -0,0 +1,155 @@
+// Copyright (c) 2013, Christian Rorvik
+// Distributed under the Simplified BSD License (See accompanying file LICENSE.txt)
+
+#include "crunch/concurrency/when_any.hpp"
+#include "crunch/concurrency/atomic.hpp"
+#include "crunch/test/framework.hpp"
+
+#include <vector>
+
+namespace Crunch { namespace Concurrency {
+
+BOOST_AUTO_TEST_SUITE(WhenAnyTests)
+
+BOOST_AUTO_TEST_CASE(FirstWinsTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // The first strategy to run wins, and the other is skipped
+    int runCount = 0;
+    CancellationToken losers = CancellationToken::Create();
+    std::vector<Future<int>> strategies;
+    strategies.push_back(scheduler.Add([&] { runCount++; return 1; }, losers));
+    strategies.push_back(scheduler.Add([&] { runCount++; return 2; }, losers));
+
+    Future<std::uint32_t> first = WhenAny(scheduler, strategies, losers);
+    BOOST_CHECK(!first.IsReady());
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(first.IsReady());
+    std::uint32_t const winner = first.Get();
+    BOOST_REQUIRE(winner < 2u);
+    BOOST_CHECK_EQUAL(runCount, 1);
+    BOOST_CHECK(!IsCancelled(strategies[winner]));
+    BOOST_CHECK(IsCancelled(strategies[1 - winner]));
+    BOOST_CHECK_EQUAL(strategies[winner].Get(), static_cast<int>(winner) + 1);
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(ReadyInputTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+    Future<void> ready = scheduler.Add([] {});
+    scheduler.GetContext().Run(throttler);
+
+    Future<void> pending = scheduler.Add([] {});
+    Future<std::uint32_t> first = WhenAny(scheduler, pending, ready);
+    BOOST_REQUIRE(first.IsReady());
+    BOOST_CHECK_EQUAL(first.Get(), 1u);
+
+    // Node is released once the remaining input completes
+    scheduler.GetContext().Run(throttler);
+    BOOST_CHECK(pending.IsReady());
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(StopLosersTest)
+{
+    TaskScheduler::Config config;
+    config.workerCount = 2;
+    TaskScheduler scheduler(config);
+
+    // A slow strategy polling the token stops as soon as the fast one wins
+    CancellationToken losers = CancellationToken::Create();
+    Atomic<std::uint32_t> slowStarted(0);
+    std::vector<Future<int>> strategies;
+    strategies.push_back(scheduler.Add([&]
+    {
+        slowStarted.Store(1);
+        while (!losers.IsCancelled());
+        return 0;
+    }, losers));
+
+    while (slowStarted.Load() == 0);
+    strategies.push_back(scheduler.Add([] { return 42; }, losers));
+
+    Future<std::uint32_t> first = WhenAny(scheduler, strategies, losers);
+    BOOST_CHECK_EQUAL(first.Get(), 1u);
+    BOOST_CHECK_EQUAL(strategies[first.Get()].Get(), 42);
+
+    strategies[0].Get();
+    BOOST_CHECK(!IsCancelled(strategies[0]));
+}
+
+BOOST_AUTO_TEST_CASE(CancelledInputTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    NullThrottler throttler;
+    CancellationToken cancelled = CancellationToken::Create();
+    cancelled.Cancel();
+
+    // A skipped input completes first, but does not win
+    Future<int> skipped = scheduler.Add([] { return 1; }, cancelled);
+    scheduler.GetContext().Run(throttler);
+    BOOST_REQUIRE(IsCancelled(skipped));
+
+    Future<int> pending = scheduler.Add([] { return 2; });
+    Future<std::uint32_t> first = WhenAny(scheduler, skipped, pending);
+    BOOST_CHECK(!first.IsReady());
+    scheduler.GetContext().Run(throttler);
+    BOOST_REQUIRE(first.IsReady());
+    BOOST_CHECK(!IsCancelled(first));
+    BOOST_CHECK_EQUAL(first.Get(), 1u);
+
+    // Without a winner the result is cancelled
+    Future<int> alsoSkipped = scheduler.Add([] { return 3; }, cancelled);
+    Future<std::uint32_t> none = WhenAny(scheduler, skipped, alsoSkipped);
+    scheduler.GetContext().Run(throttler);
+    BOOST_REQUIRE(none.IsReady());
+    BOOST_CHECK(IsCancelled(none));
+
+    // As is an empty range
+    std::vector<Future<int>> empty;
+    Future<std::uint32_t> nothing = WhenAny(scheduler, empty);
+    BOOST_REQUIRE(nothing.IsReady());
+    BOOST_CHECK(IsCancelled(nothing));
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_CASE(VariadicLosersTest)
+{
+    TaskScheduler scheduler;
+    scheduler.Enter();
+
+    // Losers are passed ahead of the futures
+    int runCount = 0;
+    CancellationToken losers = CancellationToken::Create();
+    Future<int> a = scheduler.Add([&] { runCount++; return 1; }, losers);
+    Future<int> b = scheduler.Add([&] { runCount++; return 2; }, losers);
+    Future<std::uint32_t> first = WhenAny(scheduler, losers, a, b);
+
+    NullThrottler throttler;
+    scheduler.GetContext().Run(throttler);
+
+    BOOST_REQUIRE(first.IsReady());
+    BOOST_CHECK_EQUAL(runCount, 1);
+    BOOST_CHECK(losers.IsCancelled());
+    BOOST_CHECK(IsCancelled(first.Get() == 0 ? b : a));
+
+    scheduler.Leave();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+}}
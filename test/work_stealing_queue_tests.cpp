@@ -34,6 +34,68 @@ BOOST_AUTO_TEST_CASE(BasicOperationsTest)
     BOOST_CHECK_EQUAL(queue.Steal(), (int*)0);
 }
 
+BOOST_AUTO_TEST_CASE(StealHalfTest)
+{
+    WorkStealingQueue<int> queue;
+    WorkStealingQueue<int> thief;
+    int values[9];
+
+    // Steal Fail on empty
+    BOOST_CHECK_EQUAL(queue.StealHalf(thief), (int*)0);
+    BOOST_CHECK_EQUAL(thief.Pop(), (int*)0);
+
+    // Push 9, StealHalf takes oldest 5, returning the first and moving the rest
+    for (int i = 0; i < 9; ++i)
+        queue.Push(values + i);
+
+    BOOST_CHECK_EQUAL(queue.StealHalf(thief), values);
+    for (int i = 4; i > 0; --i)
+        BOOST_CHECK_EQUAL(thief.Pop(), values + i);
+    BOOST_CHECK_EQUAL(thief.Pop(), (int*)0);
+
+    for (int i = 8; i >= 5; --i)
+        BOOST_CHECK_EQUAL(queue.Pop(), values + i);
+    BOOST_CHECK_EQUAL(queue.Pop(), (int*)0);
+
+    // Single element, StealHalf takes it without moving anything
+    queue.Push(values);
+    BOOST_CHECK_EQUAL(queue.StealHalf(thief), values);
+    BOOST_CHECK_EQUAL(thief.Pop(), (int*)0);
+    BOOST_CHECK_EQUAL(queue.Pop(), (int*)0);
+
+    // Bounded by max count
+    for (int i = 0; i < 9; ++i)
+        queue.Push(values + i);
+
+    BOOST_CHECK_EQUAL(queue.StealHalf(thief, 2), values);
+    BOOST_CHECK_EQUAL(thief.Pop(), values + 1);
+    BOOST_CHECK_EQUAL(thief.Pop(), (int*)0);
+    BOOST_CHECK_EQUAL(queue.Steal(), values + 2);
+}
+
+BOOST_AUTO_TEST_CASE(StatisticsTest)
+{
+    WorkStealingQueue<int> queue(2);
+    int values[1];
+
+    BOOST_CHECK_EQUAL(queue.GetStatistics().highWaterMark, 0u);
+
+    // Capacity is one less than the array size, so pushing 10 elements grows from 4 to 8 to 16
+    for (int i = 0; i < 10; ++i)
+        queue.Push(values);
+
+    WorkStealingQueue<int>::Statistics statistics = queue.GetStatistics();
+    BOOST_CHECK_EQUAL(statistics.highWaterMark, 10u);
+    BOOST_CHECK_EQUAL(statistics.growCount, 2u);
+    BOOST_CHECK_EQUAL(statistics.shrinkCount, 0u);
+
+    while (queue.Pop());
+
+    statistics = queue.GetStatistics();
+    BOOST_CHECK_EQUAL(statistics.highWaterMark, 10u);
+    BOOST_CHECK(statistics.shrinkCount >= 1);
+}
+
 #if 0
 BOOST_AUTO_TEST_CASE(StressTest)
 {